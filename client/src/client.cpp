@@ -6,8 +6,12 @@
 #include <ESP8266HTTPClient.h>
 #include <ArduinoJson.h>  // https://github.com/bblanchon/ArduinoJson
 
+#include <trace.h>
+#include <virtualtime.h>
+
 #include "config.h"
 #include "devices.h"
+#include "dispatcher.h"
 #include "credentials.h"
 
 Config config(NAME, AP_SSID, AP_PASSWORD, MDNS_SERVICE);
@@ -19,17 +23,23 @@ OledWithPotAndWifi oled(&display, &speedPot);
 
 Switch directionSwitch("Direction", D6);
 void IRAM_ATTR directionSwitchChanged() {
+    TRACE_INSTANT(TRACE_TRACK_ISR, "directionSwitch");
     directionSwitch.read();
     // Serial.printf("directionSwitch: %i\n", directionSwitch.getValue());
 }
 
 SwitchBlinker enableSwitch("Enable", D5);
 void IRAM_ATTR enableSwitchChanged() {
+    TRACE_INSTANT(TRACE_TRACK_ISR, "enableSwitch");
     enableSwitch.read();
     // Serial.printf("enableSwitch: %i\n", enableSwitch.getValue());
 }
 
 PotWithDirectionAndEnableCommandTask commandTask(&speedPot, &enableSwitch, &directionSwitch);
+CommandDispatcher dispatcher;
+#ifdef TRACE
+TraceDumpTask traceDump;  // prints the trace to the serial console
+#endif
 
 WiFiEventHandler connectedHandler;
 WiFiEventHandler disconnectedHandler;
@@ -62,6 +72,8 @@ void setup() {
 
     Wire.begin(D2, D1);  // oled uses I2C
 
+    WiFi.setSleepMode(WIFI_LIGHT_SLEEP);  // the idle task lets the SDK sleep between commands
+
     connectedHandler = WiFi.onStationModeConnected(&onConnected);
     disconnectedHandler = WiFi.onStationModeDisconnected(&onDisconnected);
     softAPStationConnectedHandler = WiFi.onSoftAPModeStationConnected(&onStationConnected);
@@ -79,17 +91,43 @@ void setup() {
     speedPot.movementMin = 5;  // remove jitter
     config.addDevice(&speedPot);
 
-    commandTask.keepAliveSeconds = 1800;  // 30min, set watchdog timeout higher on server
+    commandTask.slewHorizon = 1000;  // the host follows the pot's trend for up to 1s between commands
+    commandTask.scheduleDelay = 100;  // hosts apply each command 100ms after it is decided, in step with each other
+    // speedPot.setGroup("steppers");  // command every stepper in the group at once, over multicast
+    dispatcher.add(&commandTask);
+
+#ifdef BENCHMARK
+    Bench bench;
+    bench.run("Pot::read", 100, []() { speedPot.read(); });
+    bench.run("calculateCommand", 1000, []() { commandTask.calculateCommand(); });
+    char path[128];
+    bench.run("Device::commandPath", 1000, [&path]() { speedPot.commandPath(path, sizeof(path), -512, 1000, 123456789); });
+    config.benchmarkCalls(bench);
+#endif
 
     enableSwitch.setOled(&oled);
     enableSwitch.read();  // trigger blinking if disabled at boot
 
     config.setOled(&oled);
 
+    Scheduler.start(&logTask);
     Scheduler.start(&oled);
     Scheduler.start(&config);
     Scheduler.start(&speedPot);
-    Scheduler.start(&commandTask);
+    Scheduler.start(&dispatcher);
+    groupSender.addTransport(&udpTransport);
+    groupSender.addTransport(&espNowTransport);
+    // Hosts stop our motors 400 ms after we go silent. The main loop blocks
+    // in HTTP requests, each bounded by Request::timeout (250 ms), and the
+    // heartbeat goes out between them, so the longest gap is one request
+    // plus the 100 ms interval.
+    groupSender.startHeartbeat(controllerId(), 100, 400);
+    afterRequest = []() { groupSender.keepAlive(); };
+    Scheduler.start(&groupSender);
+#ifdef TRACE
+    Scheduler.start(&traceDump);
+#endif
+    Scheduler.start(&idleTask);
     Scheduler.begin();
 }
 
@@ -0,0 +1,46 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <Arduino.h>
+
+#include <clockestimate.h>
+#include <log.h>
+
+#include "request.h"
+
+// Keeps a ClockEstimate of a host's micros() clock from requests to its
+// /api/time
+class ClockSync : public ClockEstimate {
+   public:
+    int samplesPerSync = 4;
+    unsigned long syncInterval = 30000;  // ms
+    unsigned long retryInterval = 1000;  // ms between attempts until the first sync succeeds
+
+    bool due(unsigned long now) {
+        return (synced ? syncInterval : retryInterval) <= now - lastSync;
+    }
+
+    bool sync(Connection &connection) {
+        lastSync = millis();
+        char response[connection.responseBufSize];
+        begin();
+        for (int i = 0; i < samplesPerSync; i++) {
+            uint32_t t0 = micros();
+            if (HTTP_CODE_OK != connection.requestGet("/api/time", response)) continue;
+            sample(t0, strtoul(response, nullptr, 10), micros());
+        }
+        if (!end()) {
+            IPAddress &ip = connection.ip;
+            LOG_W("[ClockSync] No time from %u.%u.%u.%u\n", ip[0], ip[1], ip[2], ip[3]);
+            return false;
+        }
+        LOG_D("[ClockSync] offset: %d us  rtt: %u us  drift: %d ppb\n",
+              offset, rtt, (int)(drift * 1e9));
+        return true;
+    }
+
+   private:
+    unsigned long lastSync = 0;
+};
+
+#endif
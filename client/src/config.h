@@ -7,15 +7,19 @@
 #include <Task.h>
 #include <LeanTask.h>
 
+#include <stackmonitor.h>
+#include <trace.h>
+#ifdef BENCHMARK
+#include <bench.h>
+#endif
+
 #include <ESP8266mDNS.h>
 #include <ArduinoJson.h>  // https://github.com/bblanchon/ArduinoJson
 #include "devices.h"
 #include "request.h"
 
 #define MAX_DEVICES 32
-#ifndef JSON_CONF_SIZE
-#define JSON_CONF_SIZE 512
-#endif
+#define JSON_FILTER_SIZE 128
 
 class Config : public Task, public Request {
    public:
@@ -28,6 +32,8 @@ class Config : public Task, public Request {
     int deviceCount;
     OledWithPotAndWifi *oled;
     int discoveryLoopDelay = 3000;
+    int discoveryQueryDelay = 100;  // polling interval while waiting for mDNS answers
+    unsigned long heapLogInterval = 60000;
 
     Config(
         const char *name = "Remote",
@@ -45,7 +51,7 @@ class Config : public Task, public Request {
 
     bool addDevice(Device *device) {
         if (this->hasDevice(device->name)) {
-            Serial.printf("[Error] Device name \"%s\" already exists.", device->name);
+            LOG_E("[Error] Device name \"%s\" already exists.\n", device->name);
             return false;
         }
         this->devices[this->deviceCount] = device;
@@ -64,7 +70,7 @@ class Config : public Task, public Request {
 
     Device *device(int i) {
         if (i > this->deviceCount) {
-            Serial.printf("[Error] Device %i not found.\n", i);
+            LOG_E("[Error] Device %i not found.\n", i);
             return NULL;
         }
         return this->devices[i];
@@ -85,9 +91,36 @@ class Config : public Task, public Request {
         this->oled = oled;
     }
 
+#ifdef BENCHMARK
+    // Per host cost of reading a config, from the TXT record and from JSON
+    void benchmarkCalls(Bench &bench) {
+        if (0 == confFilter.size()) setupFilter();
+        bench.run("Config::configFromTxt", 100, [this]() {
+            conf.clear();
+            configFromTxt("v=1;rate=200;lease=5000;n=1;d0=Stepper1,stepper,-1024,1024", conf);
+        });
+        bench.run("deserializeJson config", 100, [this]() {
+            conf.clear();
+            deserializeJson(conf,
+                            "{\"name\":\"Controller\",\"rate\":200,\"lease\":5000,\"devices\":"
+                            "[{\"name\":\"Stepper1\",\"type\":\"stepper\",\"commandMin\":-1024,\"commandMax\":1024}]}",
+                            DeserializationOption::Filter(confFilter));
+        });
+        JsonObjectConst hostConf = conf.as<JsonObjectConst>();
+        for (int i = 0; i < deviceCount; i++) {
+            if ('\0' == *devices[i]->host) continue;
+            Device *device = devices[i];
+            bench.run("Device::configFromJson", 100, [device, hostConf]() { device->configFromJson(hostConf); });
+            break;
+        }
+        conf.clear();
+    }
+#endif
+
    protected:
     void setup() {
         Serial.println("Config::setup");
+        setupFilter();
         // Use wifimanager...
         // wifiManager.autoConnect(name);
 
@@ -106,7 +139,19 @@ class Config : public Task, public Request {
         MDNS.begin(this->name);
     }
 
+    void setupFilter() {
+        confFilter["rate"] = true;
+        confFilter["lease"] = true;
+        confFilter["devices"][0]["name"] = true;  // [0] applies to every element
+        confFilter["devices"][0]["commandMin"] = true;
+        confFilter["devices"][0]["commandMax"] = true;
+    }
+
     void loop() {
+        TRACE_BEGIN(TRACE_TRACK_TASK, "MDNS.update");
+        MDNS.update();
+        TRACE_END(TRACE_TRACK_TASK, "MDNS.update");
+        discoverGroups();
         int hostsNotFound = 0;
         for (int i = 0; i < this->deviceCount; i++) {
             if (0 != strcmp(this->devices[i]->host, "") && !this->devices[i]->hostAvailable) {
@@ -115,68 +160,153 @@ class Config : public Task, public Request {
         }
         if (0 == hostsNotFound) {
             // Serial.println("No discovery needed");
+            LOG_D("[Config] Idle: %d%%  free stack main: %d  config: %d\n",
+                  idleTask.idlePercent,
+                  stackMonitor.freeMainStack(),
+                  stackMonitor.freeStack(this));
+            logHeap();
+            if (0 != serviceQuery) {
+                MDNS.removeServiceQuery(serviceQuery);
+                serviceQuery = 0;
+            }
+            oled->wifiBlinkSpeed = 0;
             delay(this->discoveryLoopDelay);
             return;
         }
-        int hostsFound = 0;
-        int tries = 0;
         oled->wifiBlinkSpeed = 10;
-        while (hostsFound < hostsNotFound) {
-            tries++;
-            Serial.printf(
-                "[Config] Sending mDNS query (try %i, not found %i, found %i)\n",
-                tries,
-                hostsNotFound,
-                hostsFound);
-            int numServices = MDNS.queryService(this->mdnsService, this->mdnsProtocol);
-            if (numServices == 0) {
-                Serial.println("[Config] no services found");
+        if (0 != serviceQuery && (unsigned long)this->discoveryLoopDelay < millis() - queryStartTime) {
+            // nothing useful came in, start over with a fresh query
+            MDNS.removeServiceQuery(serviceQuery);
+            serviceQuery = 0;
+        }
+        if (0 == serviceQuery) {
+            Serial.printf("[Config] Sending mDNS query (not found %i)\n", hostsNotFound);
+            TRACE_SCOPE(TRACE_TRACK_TASK, "MDNS.installServiceQuery");
+            serviceQuery = MDNS.installServiceQuery(this->mdnsService, this->mdnsProtocol, nullptr);
+            queryStartTime = millis();
+        }
+        HeapProbe probe(heapDiscovery);
+        uint32_t numServices = MDNS.answerCount(serviceQuery);
+        for (uint32_t s = 0; s < numServices; ++s) {
+            if (!MDNS.hasAnswerIP4Address(serviceQuery, s) || !MDNS.hasAnswerPort(serviceQuery, s)) continue;
+            const char *hostDomain = MDNS.answerHostDomain(serviceQuery, s);
+            IPAddress ip = MDNS.answerIP4Address(serviceQuery, s, 0);
+            uint16_t port = MDNS.answerPort(serviceQuery, s);
+            bool hostNeeded = false;
+            for (int d = 0; d < this->deviceCount; d++) {
+                if (this->devices[d]->hostAvailable || !isHostOf(this->devices[d], hostDomain)) continue;
+                this->devices[d]->hostIp = ip;
+                this->devices[d]->hostPort = port;
+                hostNeeded = true;
+            }
+            if (!hostNeeded) continue;
+            Serial.printf("[Config] %s(%s:%i)\n", hostDomain, ip.toString().c_str(), port);
+            conf.clear();
+            if (MDNS.hasAnswerTxts(serviceQuery, s) &&
+                configFromTxt(MDNS.answerTxts(serviceQuery, s), conf)) {
+                LOG_I("[Config] Using config from TXT record\n");
             } else {
-                Serial.printf("[Config] %i service%s found\n", numServices, numServices > 1 ? "s" : "");
-                int deviceHostMap[this->deviceCount];
-                for (int s = 0; s < numServices; ++s) {
-                    Serial.printf("%i: ", s + 1);
-                    for (int d = 0; d < this->deviceCount; d++) {
-                        if (0 == strcmp(this->devices[d]->host, "")) continue;
-                        char search[64];
-                        snprintf(search, 64, "%s.local", this->devices[d]->host);
-                        if (0 == strcmp(search, MDNS.answerHostname(s))) {
-                            Serial.print("*");
-                            this->devices[d]->hostIp = MDNS.answerIP(s);
-                            this->devices[d]->hostPort = MDNS.answerPort(s);
-                            deviceHostMap[d] = s;
-                            hostsFound++;
-                        }
-                    }
-                    Serial.printf("%s(%s:%i)\n",
-                                  MDNS.answerHostname(s),
-                                  MDNS.answerIP(s).toString().c_str(),
-                                  MDNS.answerPort(s));
-                    char url[100];
-                    sprintf(url, "http://%s:%i/api/config",
-                            MDNS.answerIP(s).toString().c_str(),
-                            MDNS.answerPort(s));
-                    char response[this->responseBufSize];
-                    int http_code = this->requestGet(url, response);
-                    if (http_code == HTTP_CODE_OK) {
-                        Serial.print("[Config] HTTP code OK\n");
-                        StaticJsonDocument<JSON_CONF_SIZE> conf;
-                        deserializeJson(conf, response);
-                        for (int d = 0; d < this->deviceCount; d++) {
-                            if (deviceHostMap[d] == s) {
-                                if (this->devices[d]->configFromJson(conf)) {
-                                    this->devices[d]->hostAvailable = true;
-                                }
-                            }
-                        }
-                    }
+                conf.clear();
+                char url[100];
+                sprintf(url, "http://%s:%i/api/config", ip.toString().c_str(), port);
+                TRACE_BEGIN(TRACE_TRACK_TASK, "GET /api/config");
+                int http_code = this->requestJson(url, conf, confFilter);
+                TRACE_END(TRACE_TRACK_TASK, "GET /api/config");
+                if (http_code != HTTP_CODE_OK) continue;
+                Serial.print("[Config] HTTP code OK\n");
+            }
+            JsonObjectConst hostConf = conf.as<JsonObjectConst>();
+            for (int d = 0; d < this->deviceCount; d++) {
+                if (this->devices[d]->hostAvailable || !isHostOf(this->devices[d], hostDomain)) continue;
+                if (this->devices[d]->configFromJson(hostConf)) {
+                    this->devices[d]->hostAvailable = true;
                 }
             }
-            Serial.println();
-            if (1 < tries) delay(this->discoveryLoopDelay);
         }
-        oled->wifiBlinkSpeed = 0;
+        delay(this->discoveryQueryDelay);
     }
+
+    // Group devices need no mDNS, their servers announce them with beacons
+    void discoverGroups() {
+        for (int i = 0; i < this->deviceCount; i++) {
+            Device *device = this->devices[i];
+            if ('\0' == *device->group || device->hostAvailable) continue;
+            const GroupBeacon *beacon = groupSender.beaconOf(device->group);
+            if (nullptr != beacon && device->configFromBeacon(*beacon))
+                device->hostAvailable = true;
+        }
+    }
+
+    void logHeap() {
+        unsigned long now = millis();
+        if (0 < heapLogTime && now - heapLogTime < heapLogInterval) return;
+        heapLogTime = now;
+        heapMonitor.sample();
+        LOG_I("[Heap] free: %u (min %u)  max block: %u (min %u)  fragmentation: %u%% (max %u%%)  allocations: %u\n",
+              heapMonitor.freeHeap,
+              heapMonitor.minFreeHeap,
+              heapMonitor.maxFreeBlock,
+              heapMonitor.minMaxFreeBlock,
+              heapMonitor.fragmentation,
+              heapMonitor.maxFragmentation,
+              heapAllocations);
+        for (int i = 0; i < this->deviceCount; i++) {
+            if (0 == this->devices[i]->commandLatency) continue;
+            LOG_I("[Transport] %s HTTP round trip: %u us\n", this->devices[i]->name, this->devices[i]->commandLatency);
+        }
+        LOG_I("[Transport] ESP-NOW send callback: %u us  frames sent: %u\n", espNowTransport.sendLatency, espNowTransport.sent);
+        for (int i = 0; i < heapMonitor.handlerCount; i++) {
+            LOG_I("[Heap] %s: %u calls, %u allocations, %d bytes retained\n",
+                  heapMonitor.handlers[i].name,
+                  heapMonitor.handlers[i].calls,
+                  heapMonitor.handlers[i].allocations,
+                  heapMonitor.handlers[i].retained);
+        }
+    }
+
+    bool isHostOf(Device *device, const char *hostDomain) {
+        if (0 == strcmp(device->host, "")) return false;
+        char search[64];
+        snprintf(search, 64, "%s.local", device->host);
+        return 0 == strcmp(search, hostDomain);
+    }
+
+    // Builds a document shaped like the /api/config reply from the TXT answer,
+    // see parseTxtConfig(). Returns false if the record is missing, from
+    // another version or truncated.
+    bool configFromTxt(const char *txts, JsonDocument &conf) {
+        if (nullptr == txts) return false;
+        char buf[strlen(txts) + 1];
+        strcpy(buf, txts);
+        TxtConfig txt;
+        if (!parseTxtConfig(buf, txt)) {
+            LOG_W("[Config] TXT record unusable (v%i, %i/%i devices)\n", txt.version, txt.found, txt.count);
+            return false;
+        }
+        conf["rate"] = txt.rate;
+        if (txt.hasLease) conf["lease"] = txt.lease;
+        JsonArray devices = conf.createNestedArray("devices");
+        for (int i = 0; i < txt.found; i++) {
+            JsonObject device = devices.createNestedObject();
+            device["name"] = (char *)txt.devices[i].name;  // copied, buf goes away
+            device["type"] = (char *)txt.devices[i].type;
+            if (!txt.devices[i].range) continue;
+            device["commandMin"] = txt.devices[i].commandMin;
+            device["commandMax"] = txt.devices[i].commandMax;
+        }
+        if (conf.overflowed()) {
+            LOG_W("[Config] TXT record too large, %i devices\n", txt.found);
+            return false;
+        }
+        return true;
+    }
+
+   private:
+    StaticJsonDocument<JSON_CONF_SIZE> conf;         // config of the host being set up, reused for every host
+    StaticJsonDocument<JSON_FILTER_SIZE> confFilter;  // the fields of /api/config the devices use
+    MDNSResponder::hMDNSServiceQuery serviceQuery = 0;
+    unsigned long queryStartTime = 0;
+    unsigned long heapLogTime = 0;
 };
 
 #endif
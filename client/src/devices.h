@@ -8,20 +8,41 @@
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
 
+#include <heapmonitor.h>
+#include <log.h>
+#include <remotecommand.h>
+#include <tickless.h>
+#include <trace.h>
+
+#include "groupsender.h"
 #include "request.h"
 
+#define MAX_HOST_DEVICES 32  // devices per host the config document has room for
 #ifndef JSON_CONF_SIZE
-#define JSON_CONF_SIZE 512
+// rate, lease and devices, each device with name, commandMin, commandMax and room for the name
+#define JSON_CONF_SIZE (JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(MAX_HOST_DEVICES) + MAX_HOST_DEVICES * (JSON_OBJECT_SIZE(3) + 32))
 #endif
 
 class OledWithPotAndWifi;
 
+// Identifies this remote to the hosts, which lease devices to one controller at a time
+const char *controllerId() {
+    static char id[9] = "";
+    if ('\0' == id[0]) snprintf(id, sizeof(id), "%06x", ESP.getChipId());
+    return id;
+}
+
+HandlerHeapStats *heapSendCommand = heapMonitor.addHandler("sendCommand");
+HandlerHeapStats *heapDiscovery = heapMonitor.addHandler("discovery");
+
 class Device : public Request {
    public:
     const char *name;
     const char *host;
     bool hostAvailable = false;
     int hostRate = 1000;
+    unsigned long hostLease = 0;  // ms the host keeps the device for us after a command, 0: unknown
+    int priority = 0;             // commands with a higher priority take over leased devices
     IPAddress hostIp;
     int hostPort;
     const char *hostDevice;
@@ -29,9 +50,13 @@ class Device : public Request {
     int lastCommand;
     int commandFailCount = 0;
     int commandFailMax = 5;
+    unsigned long backoffUntil = 0;  // ms, no commands before, set when the host sheds or rate limits us, 0: none
     int movementMin = 0;  // minimum difference between value and lastCommand to trigger sendCommand()
     bool invert = false;
     OledWithPotAndWifi *oled;
+    Connection *connection = nullptr;  // requests to the host, set by the dispatcher
+    uint32_t commandLatency = 0;       // us, moving average of HTTP command round trips
+    const char *group = "";            // multicast group commanded instead of a host, "" for none
 
     Device() {
         this->name = "";
@@ -45,7 +70,14 @@ class Device : public Request {
 
     void blinkOledPercent(int speed);
     void blinkOledWifi(int speed);
-    bool sendCommand(int command);
+    bool sendCommand(int command, unsigned long slew = 0, uint32_t at = 0);
+    int commandPath(char *buf, size_t size, int command, unsigned long slew = 0, uint32_t at = 0);
+
+    // Commands go to every server device following [group] instead of to a
+    // host, the device becomes available once a beacon of the group is heard
+    void setGroup(const char *group) {
+        this->group = group;
+    }
 
     void setOled(OledWithPotAndWifi *oled) {
         this->oled = oled;
@@ -55,16 +87,24 @@ class Device : public Request {
         return getValue();
     }
 
-    virtual bool configFromJson(StaticJsonDocument<JSON_CONF_SIZE> conf) {
-        if (conf.containsKey("rate") && conf["rate"].is<int>()) {
+    // conf is a read-only view of the host's config, shared by all its devices
+    virtual bool configFromJson(JsonObjectConst conf) {
+        if (conf["lease"].is<unsigned long>())
+            this->hostLease = conf["lease"];
+        if (conf["rate"].is<int>()) {
             this->hostRate = conf["rate"];
-            Serial.printf("[Pot %s] Host rate: %i\n",
-                          this->name, this->hostRate);
+            LOG_I("[Pot %s] Host rate: %i\n", this->name, this->hostRate);
             return true;
         }
         return false;
     }
 
+    virtual bool configFromBeacon(const GroupBeacon &beacon) {
+        if (0 < beacon.rate) hostRate = beacon.rate;
+        LOG_I("[%s] Group %s on %s, rate: %i\n", name, group, beacon.host, hostRate);
+        return true;
+    }
+
     virtual int read() {
         return getValue();
     };
@@ -81,7 +121,7 @@ class Device : public Request {
     int value;
 };
 
-class Pot : public Device, public Task {
+class Pot : public Device, public DeadlineTask {
    public:
     int min = 0;
     int max = 1024;
@@ -109,13 +149,8 @@ class Pot : public Device, public Task {
     }
 
     int calculateCommand() {
-        int out = map(
-            getValue(),
-            min,
-            max,
-            commandMin,
-            commandMax);
-        Serial.printf(
+        int out = potCommand(getValue(), min, max, commandMin, commandMax);
+        LOG_D(
             "[Pot %s] calculateCommand: %i (%i ... %i) => %i (%i ... %i)\n",
             name,
             getValue(),
@@ -132,60 +167,55 @@ class Pot : public Device, public Task {
         for (int x = 0; x < numMeasurements; x++) {
             total += analogRead(pin);
         }
-        if (total > measurementMax) {
-            Serial.printf("[POT %s] measurement overflow", name);
-            setValue(max);
-        } else {
-            int measurement = total / numMeasurements;
-            if (measurement < min) {
-                setValue(min);
-            } else if (measurement > max) {
-                setValue(max);
-            } else {
-                setValue(measurement);
-            }
-        }
-        total = 0;
+        if (total > measurementMax) LOG_W("[POT %s] measurement overflow\n", name);
+        setValue(averageReading(total, numMeasurements, min, max));
         return getValue();
     }
 
-    bool configFromJson(StaticJsonDocument<JSON_CONF_SIZE> conf) {
+    bool configFromJson(JsonObjectConst conf) {
         bool ret = Device::configFromJson(conf);
         if (!ret) return false;
-        if (conf.containsKey("devices")) {
-            if (NULL != conf["devices"]) {
-                for (unsigned int i = 0; i < conf["devices"].size(); i++) {
-                    Serial.printf("Checking device %i to match %s\n", i, this->hostDevice);
-                    if (conf["devices"][i]["name"] == this->hostDevice) {
-                        Serial.printf("[Pot %s] Host device found\n", this->name);
-                        if (conf["devices"][i]["commandMin"].is<int>())
-                            this->commandMin = conf["devices"][i]["commandMin"];
-                        if (conf["devices"][i]["commandMax"].is<int>())
-                            this->commandMax = conf["devices"][i]["commandMax"];
-                        validateMinMax();
-                        Serial.printf("[Pot %s] Host device command min: %i, max: %i\n",
-                                      this->name, this->commandMin, this->commandMax);
-                        return ret;
-                    }
-                }
-            }
+        for (JsonObjectConst device : conf["devices"].as<JsonArrayConst>()) {
+            LOG_D("Checking device to match %s\n", this->hostDevice);
+            if (device["name"] != this->hostDevice) continue;
+            LOG_D("[Pot %s] Host device found\n", this->name);
+            if (device["commandMin"].is<int>())
+                this->commandMin = device["commandMin"];
+            if (device["commandMax"].is<int>())
+                this->commandMax = device["commandMax"];
+            validateMinMax();
+            LOG_I("[Pot %s] Host device command min: %i, max: %i\n",
+                  this->name, this->commandMin, this->commandMax);
+            return ret;
         }
         return false;
     }
 
+    // the beacon's summary is "name,type,commandMin,commandMax" for steppers
+    bool configFromBeacon(const GroupBeacon &beacon) {
+        if (!Device::configFromBeacon(beacon)) return false;
+        int min, max;
+        if (2 == sscanf(beacon.summary, "%*[^,],%*[^,],%d,%d", &min, &max)) {
+            commandMin = min;
+            commandMax = max;
+            validateMinMax();
+        }
+        return true;
+    }
+
     void validateMinMax() {
         if (commandMax < commandMin) {
-            Serial.printf("[Pot] validateMinMax Warning: max < min, swapping\n");
+            LOG_W("[Pot] validateMinMax Warning: max < min, swapping\n");
             int tmp = commandMax;
             commandMax = commandMin;
             commandMin = tmp;
         }
         if (-1 < commandMin) {
-            Serial.printf("[Pot] validateMinMax Warning: -1 < min\n");
+            LOG_W("[Pot] validateMinMax Warning: -1 < min\n");
             commandMin = -1;
         }
         if (commandMax < 1) {
-            Serial.printf("[Pot] validateMinMax Warning: max < 1\n");
+            LOG_W("[Pot] validateMinMax Warning: max < 1\n");
             commandMax = 1;
         }
     }
@@ -196,12 +226,13 @@ class Pot : public Device, public Task {
     }
 
     virtual void loop() {
+        TRACE_SCOPE(TRACE_TRACK_LOOP, "Pot::read");
         read();
-        delay(measurementDelay);
+        sleep(measurementDelay);
     }
 };
 
-class Oled : public Task {
+class Oled : public DeadlineTask {
    public:
     int reset = -1;
     int width = 128;
@@ -221,6 +252,12 @@ class Oled : public Task {
         display->setCursor(cursorX, cursorY);
         display->cp437(true);
         display->print(text);
+        flush();
+    }
+
+    // Sends the frame buffer to the display, blocks for the I2C transfer
+    void flush() {
+        TRACE_SCOPE(TRACE_TRACK_LOOP, "display");
         display->display();
     }
 
@@ -233,7 +270,7 @@ class Oled : public Task {
         display->ssd1306_command(SSD1306_DISPLAYON);
         display->dim(true);
         display->clearDisplay();
-        display->display();
+        flush();
     }
 
     virtual void loop() {
@@ -258,7 +295,7 @@ class OledWithPotAndWifi : public Oled {
             display->drawBitmap(0, 0, wifiIcon, wifiIconWidth, wifiIconHeight, SSD1306_WHITE);
         else
             display->fillRect(0, 0, wifiIconWidth, wifiIconHeight, SSD1306_BLACK);
-        display->display();
+        flush();
     }
 
     void writePercent(uint8_t percent, bool visible = true) {
@@ -333,14 +370,14 @@ class OledWithPotAndWifi : public Oled {
             potLastValue = potValue;
         }
         if (0 < percentBlinkSpeed &&
-            percentVisibleLastChange < millis() - 1000 / percentBlinkSpeed) {
+            (unsigned long)(1000 / percentBlinkSpeed) < millis() - percentVisibleLastChange) {
             percentVisible = !percentVisible;
             writePercent(potPercent, percentVisible);
             percentVisibleLastChange = millis();
         }
 
         if (0 < wifiBlinkSpeed) {
-            if (wifiIconLastChange < millis() - 1000 / wifiBlinkSpeed) {
+            if ((unsigned long)(1000 / wifiBlinkSpeed) < millis() - wifiIconLastChange) {
                 wifiIconVisible = !wifiIconVisible;
                 drawWifi(wifiIconVisible);
                 wifiIconLastChange = millis();
@@ -349,7 +386,7 @@ class OledWithPotAndWifi : public Oled {
             drawWifi(0 < wifiConnected);
             wifiConnectedLastValue = wifiConnected;
         }
-        delay(pot->measurementDelay);
+        sleep(pot->measurementDelay);
     }
 };
 
@@ -363,29 +400,66 @@ void Device::blinkOledPercent(int speed) {
     oled->percentBlinkSpeed = speed;
 }
 
-bool Device::sendCommand(int command) {
+// Formats the /api/control request for [command], see sendCommand()
+int Device::commandPath(char *buf, size_t size, int command, unsigned long slew, uint32_t at) {
+    return formatCommandPath(buf, size, hostDevice, command, slew, at, controllerId(), priority);
+}
+
+// With [slew] the host moves to [command] over that many ms instead of at once,
+// with [at] it starts when its micros() reaches [at] instead of on arrival
+bool Device::sendCommand(int command, unsigned long slew, uint32_t at) {
     if (!hostAvailable) return false;
-    Serial.printf("[Device %s] Sending command: %d\n", name, command);
-    char url[100];
-    sprintf(url, "http://%s:%i/api/control?device=%s&command=%i",
-            hostIp.toString().c_str(),
-            hostPort,
-            hostDevice,
-            command);
+    if ('\0' != *group) {
+        if (!groupSender.send(group, controllerId(), command, slew)) return false;
+        lastCommand = command;
+        return true;
+    }
+    HeapProbe probe(heapSendCommand);
+    TRACE_SCOPE(TRACE_TRACK_LOOP, "sendCommand");
+    LOG_D("[Device %s] Sending command: %d slew: %lu at: %u\n", name, command, slew, at);
     char response[this->responseBufSize];
+    char path[128];
+    commandPath(path, sizeof(path), command, slew, at);
+    int statusCode;
     blinkOledWifi(10);
-    int statusCode = this->requestGet(url, response);
+    uint32_t start = micros();
+    if (nullptr != connection && connection->ip == hostIp && connection->port == hostPort) {
+        statusCode = connection->requestGet(path, response);
+        rateHint = connection->rateHint;
+        retryAfter = connection->retryAfter;
+    } else {
+        char url[160];
+        snprintf(url, sizeof(url), "http://%s:%i%s", hostIp.toString().c_str(), hostPort, path);
+        statusCode = this->requestGet(url, response);
+    }
     blinkOledWifi(0);
-    if (statusCode == HTTP_CODE_OK) {
+    commandLatency = commandLatency - commandLatency / 8 + (micros() - start) / 8;
+    if (0 < rateHint && rateHint != hostRate) {
+        LOG_D("[%s] Host rate: %i\n", name, rateHint);
+        hostRate = rateHint;
+    }
+    if (statusCode == HTTP_CODE_OK || statusCode == HTTP_CODE_NO_CONTENT) {
         lastCommand = command;
         commandFailCount = 0;
         return true;
     }
+    if (statusCode == HTTP_CODE_CONFLICT) {
+        // another controller holds the lease, the host is fine
+        LOG_D("[%s] Host device leased by another controller\n", name);
+        return false;
+    }
+    if (statusCode == HTTP_CODE_TOO_MANY_REQUESTS || statusCode == HTTP_CODE_SERVICE_UNAVAILABLE) {
+        // the host is busy, not gone: back off for as long as it asks
+        unsigned long wait = 0 < retryAfter ? retryAfter * 1000UL : (unsigned long)hostRate;
+        backoffUntil = millis() + wait;
+        LOG_D("[%s] Host busy, HTTP code %i, retrying in %lu ms\n", name, statusCode, wait);
+        return false;
+    }
     commandFailCount++;
-    Serial.printf("[%s] Command reply HTTP code %i, streak %i\n",
-                  name,
-                  statusCode,
-                  commandFailCount);
+    LOG_W("[%s] Command reply HTTP code %i, streak %i\n",
+          name,
+          statusCode,
+          commandFailCount);
     if (commandFailCount >= commandFailMax) {
         hostAvailable = false;
         commandFailCount = 0;
@@ -444,39 +518,115 @@ class SwitchBlinker : public Switch {
     }
 };
 
-class DeviceCommandTask : public Task, public Request {
+// Decides when a device's command is due, sending is done by the CommandDispatcher.
+// With slewHorizon set, each command is a segment that continues the input's
+// trend for that long on the host, and a new one is only sent once the input
+// leaves the path the host is expected to follow.
+class DeviceCommandTask {
    public:
     Device *device;
-    int keepAliveSeconds = 5;  // send command to keep connection alive
+    unsigned long renewInterval = 60000;  // ms between repeated commands if the host has no lease
+    unsigned long leaseMargin = 1000;     // ms before the host's lease runs out that a repeat renews it
+    unsigned long slewHorizon = 0;        // ms of input trend a command extrapolates, 0: plain set points
+    unsigned long scheduleDelay = 0;      // ms from deciding a command to the host applying it, 0: on arrival
     unsigned long lastCommandSent = 0;
 
     DeviceCommandTask(Device *device) {
         this->device = device;
     }
 
-   protected:
-    virtual void loop() {
-        if (!device->hostAvailable) {
-            delay(device->hostRate);
-            return;
+    // Returns true and sets command if a command should be sent now
+    bool due(unsigned long now, int *command) {
+        if (!device->hostAvailable) return false;
+        if (0 < lastAttempt && now - lastAttempt < (unsigned long)device->hostRate) return false;
+        if (0 < device->backoffUntil) {
+            if (0 < (long)(device->backoffUntil - now)) return false;
+            device->backoffUntil = 0;  // over, cleared before millis() can wrap past it
         }
-        int command = calculateCommand();
-        int commandDiff = abs(device->lastCommand - command);
-        long cutoff = millis() - keepAliveSeconds * 1000;
-        if (commandDiff > device->movementMin                           //
-            || (lastCommandSent < (unsigned long)cutoff && 0 < cutoff)  //
+        *command = calculateCommand();
+        track(now, *command);
+        int commandDiff = abs(expected(now) - *command);
+        // repeating the command renews the lease, which also feeds the host's
+        // watchdog, shortly before it runs out: the margin covers a check
+        // interval and a round trip. Heartbeats renew it without, then a rare
+        // repeat only resyncs a host that lost the command
+        unsigned long renew = renewInterval;
+        if (0 < device->hostLease && !groupSender.heartbeating()) {
+            unsigned long margin = leaseMargin + device->hostRate;
+            renew = margin < device->hostLease / 2 ? device->hostLease - margin : device->hostLease / 2;
+        }
+        if (commandDiff > device->movementMin     //
+            || renew <= now - lastCommandSent  //
             || 0 == lastCommandSent) {
-            if (device->sendCommand(command))
-                lastCommandSent = millis();
-        } else if (commandDiff > 0) {
-            Serial.printf("[%s] %d movement too small\n", device->name, commandDiff);
+            return true;
         }
-        delay(device->hostRate);
+        if (commandDiff > 0) {
+            LOG_D("[%s] %d movement too small\n", device->name, commandDiff);
+        }
+        lastAttempt = now;
+        return false;
+    }
+
+    // Earliest time due() can return true while the host is available
+    unsigned long nextCheck() {
+        unsigned long next = lastAttempt + device->hostRate;
+        return 0 < device->backoffUntil && 0 < (long)(device->backoffUntil - next) ? device->backoffUntil : next;
+    }
+
+    // [at]: host time to apply the command, 0: on arrival
+    bool send(int command, uint32_t at = 0) {
+        lastAttempt = millis();
+        int target = command;
+        unsigned long duration = 0;
+        if (0 < slewHorizon && 0 != command) {
+            target = command + trend * (long)slewHorizon / 1000;
+            if ((0 < command) != (0 < target)) target = 0;  // never extrapolate through a stop
+            if (target != command) duration = slewHorizon;
+        }
+        if (!device->sendCommand(target, duration, at)) return false;
+        lastCommandSent = lastAttempt;
+        segmentFrom = command;
+        segmentTo = target;
+        segmentStart = lastAttempt;
+        segmentDuration = duration;
+        return true;
+    }
+
+    // The set point the host should have reached by [now]
+    int expected(unsigned long now) {
+        unsigned long elapsed = now - segmentStart;
+        if (segmentDuration <= elapsed) return segmentTo;
+        return segmentFrom + (long)(segmentTo - segmentFrom) * (long)elapsed / (long)segmentDuration;
     }
 
     virtual int calculateCommand() {
         return device->calculateCommand();
     }
+
+   protected:
+    unsigned long lastAttempt = 0;  // time of the last check or send
+    int segmentFrom = 0;            // last segment sent
+    int segmentTo = 0;
+    unsigned long segmentStart = 0;
+    unsigned long segmentDuration = 0;
+    int lastInput = 0;
+    unsigned long lastInputTime = 0;
+    long lastVelocity = 0;  // units/s between the last two checks
+    long trend = 0;         // units/s, 0 unless the input moved the same way twice in a row
+
+    // A single change, like a switch flipping, has no trend
+    void track(unsigned long now, int input) {
+        unsigned long dt = now - lastInputTime;
+        if (0 == dt) return;
+        long velocity = (long)(input - lastInput) * 1000 / (long)dt;
+        if ((0 < velocity && 0 < lastVelocity) || (velocity < 0 && lastVelocity < 0))
+            trend = abs(velocity) < abs(lastVelocity) ? velocity : lastVelocity;
+        else
+            trend = 0;
+        lastVelocity = velocity;
+        lastInput = input;
+        lastInputTime = now;
+    }
 };
 
 class PotWithDirectionAndEnableCommandTask : public DeviceCommandTask {
@@ -492,35 +642,9 @@ class PotWithDirectionAndEnableCommandTask : public DeviceCommandTask {
     }
 
     int calculateCommand() {
-        int out;
-        if (enable->getValue() != HIGH)
-            out = 0;
-        else {
-            int inMin;
-            int inMax;
-            if (pot->invert) {
-                inMin = pot->max;
-                inMax = pot->min;
-            } else {
-                inMin = pot->min;
-                inMax = pot->max;
-            }
-            int outMin;
-            int outMax;
-            if (direction->getValue() == HIGH) {
-                outMin = -1;
-                outMax = pot->commandMin;
-            } else {
-                outMin = 1;
-                outMax = pot->commandMax;
-            }
-            out = map(
-                pot->getValue(),
-                inMin,
-                inMax,
-                outMin,
-                outMax);
-        }
+        int out = potDirectionCommand(pot->getValue(), pot->min, pot->max, pot->invert,
+                                      enable->getValue() == HIGH, direction->getValue() == HIGH,
+                                      pot->commandMin, pot->commandMax);
         /*
         Serial.printf(
             "[PotWithDirectionAndEnableCommandTask] calculateCommand: %s %s %i (%i ... %i) => %i (%i ... %i)\n",
@@ -0,0 +1,128 @@
+#ifndef DISPATCHER_H
+#define DISPATCHER_H
+
+#include <tickless.h>
+#include <trace.h>
+
+#include "clocksync.h"
+#include "devices.h"
+#include "request.h"
+
+#define MAX_COMMAND_TASKS 32
+#define MAX_HOSTS 8
+
+// Single network task for all devices: collects due commands from the
+// command tasks and sends them one request each, grouped by host and at
+// most maxSendsPerLoop per loop. Input tasks only update device values.
+// Commands of tasks with a scheduleDelay are stamped with the host time of
+// the loop's start plus that delay, so hosts synced to the same remote
+// apply commands decided together at the same instant.
+class CommandDispatcher : public DeadlineTask {
+   public:
+    DeviceCommandTask *tasks[MAX_COMMAND_TASKS];
+    int taskCount = 0;
+    int maxSendsPerLoop = 4;  // bounds the time spent in one loop so input and display tasks keep running
+    int maxSleep = 100;       // ms, how long to wait at most, e.g. for a host to be discovered
+
+    bool add(DeviceCommandTask *task) {
+        if (MAX_COMMAND_TASKS <= taskCount) {
+            LOG_E("[Dispatcher] Cannot add \"%s\", too many command tasks\n", task->device->name);
+            return false;
+        }
+        tasks[taskCount] = task;
+        taskCount++;
+        return true;
+    }
+
+   protected:
+    Connection connections[MAX_HOSTS];
+    ClockSync clocks[MAX_HOSTS];  // one per connection
+    int connectionCount = 0;
+    int nextConnection = 0;
+
+    void loop() {
+        TRACE_SCOPE(TRACE_TRACK_LOOP, "dispatch");
+        syncClock();
+        unsigned long now = millis();
+        uint32_t decided = micros();
+        int sent = 0;
+        // round robin over hosts so a busy host does not starve the others
+        for (int c = 0; c <= connectionCount && sent < maxSendsPerLoop; c++) {
+            Connection *connection = nullptr;
+            if (c < connectionCount) {
+                connection = &connections[(nextConnection + c) % connectionCount];
+            }
+            for (int i = 0; i < taskCount && sent < maxSendsPerLoop; i++) {
+                Device *device = tasks[i]->device;
+                if (nullptr == connection) {
+                    // last pass: devices whose host has no connection yet
+                    if (nullptr != device->connection) continue;
+                } else if (connection != device->connection) {
+                    continue;
+                }
+                int command;
+                if (!tasks[i]->due(now, &command)) continue;
+                if ('\0' == *device->group) device->connection = connectionTo(device);
+                tasks[i]->send(command, scheduleTime(tasks[i], decided));
+                sent++;
+            }
+        }
+        if (0 < connectionCount) nextConnection = (nextConnection + 1) % connectionCount;
+        if (maxSendsPerLoop <= sent) return;  // more may be due, run again
+        unsigned long wakeTime = millis() + maxSleep;
+        for (int i = 0; i < taskCount; i++) {
+            if (!tasks[i]->device->hostAvailable) continue;
+            unsigned long next = tasks[i]->nextCheck();
+            if ((long)(next - wakeTime) < 0) wakeTime = next;
+        }
+        wakeAt(wakeTime);
+    }
+
+    // Syncs at most one host's clock per loop, before commands are decided,
+    // and only if a task schedules its commands
+    void syncClock() {
+        bool scheduling = false;
+        for (int i = 0; i < taskCount && !scheduling; i++)
+            scheduling = 0 < tasks[i]->scheduleDelay;
+        if (!scheduling) return;
+        unsigned long now = millis();
+        for (int c = 0; c < connectionCount; c++) {
+            if (!clocks[c].due(now)) continue;
+            TRACE_SCOPE(TRACE_TRACK_LOOP, "clockSync");
+            clocks[c].sync(connections[c]);
+            return;
+        }
+    }
+
+    // Host time at which the task's command decided at local micros() [decided]
+    // is to be applied, 0 to apply it on arrival
+    uint32_t scheduleTime(DeviceCommandTask *task, uint32_t decided) {
+        Connection *connection = task->device->connection;
+        if (0 == task->scheduleDelay || nullptr == connection) return 0;
+        ClockSync *clock = &clocks[connection - connections];
+        if (!clock->synced) return 0;
+        uint32_t at = clock->hostTime(decided) + task->scheduleDelay * 1000;
+        return 0 == at ? 1 : at;
+    }
+
+    // Returns the connection to the device's host, opening a slot if needed
+    Connection *connectionTo(Device *device) {
+        for (int c = 0; c < connectionCount; c++) {
+            if (connections[c].ip == device->hostIp && connections[c].port == device->hostPort) {
+                return &connections[c];
+            }
+        }
+        if (MAX_HOSTS <= connectionCount) {
+            LOG_W("[Dispatcher] No connection slot for %s\n", device->host);
+            return nullptr;
+        }
+        Connection *connection = &connections[connectionCount];
+        connection->ip = device->hostIp;
+        connection->port = device->hostPort;
+        connectionCount++;
+        LOG_I("[Dispatcher] New connection to %s\n", device->host);
+        return connection;
+    }
+};
+
+#endif
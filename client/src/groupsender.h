@@ -0,0 +1,167 @@
+#ifndef GROUPSENDER_H
+#define GROUPSENDER_H
+
+#include <groupcommand.h>
+#include <log.h>
+#include <tickless.h>
+#include <trace.h>
+#include <transport.h>
+
+#define GROUP_SENDER_MAX_GROUPS 4
+#define GROUP_MAX_TRANSPORTS 3
+
+// Sends group commands over every transport, one frame per change whatever
+// the number of servers in the group. The latest command of every group is
+// repeated each refreshInterval, so a receiver that lost a frame catches up.
+// Also keeps the latest beacon heard for each group.
+//
+// Once startHeartbeat() is called, a GroupHeartbeat goes out every
+// heartbeatInterval, unless a command frame went out in that time, which
+// servers count as one. Servers then stop the devices this remote leased
+// within the heartbeat timeout of it going silent, and renew its leases
+// meanwhile, so commands are no longer repeated to keep them, see
+// DeviceCommandTask. Group devices stopped after a short loss get their
+// command back with the next refresh, others with the next change or the
+// next renewInterval repeat.
+class GroupSender : public DeadlineTask {
+   public:
+    unsigned long refreshInterval = 1000;  // ms
+    unsigned long pollDelay = 100;         // ms between checks for beacons
+    uint32_t sent = 0;
+    unsigned long heartbeatInterval = 0;  // ms, 0: no heartbeats
+
+    bool addTransport(Transport *transport) {
+        if (GROUP_MAX_TRANSPORTS <= transportCount) return false;
+        transports[transportCount++] = transport;
+        return true;
+    }
+
+    bool send(const char *group, const char *client, int command, unsigned long slew = 0) {
+        GroupCommand *datagram = latestOf(group);
+        if (nullptr == datagram) {
+            LOG_W("[Group] No slot for group \"%s\"\n", group);
+            return false;
+        }
+        if (0 == session) session = ESP.random() | 1;
+        datagram->session = session;
+        datagram->sequence = ++sequence;
+        strncpy(datagram->client, client, GROUP_CLIENT_SIZE - 1);
+        datagram->client[GROUP_CLIENT_SIZE - 1] = '\0';
+        datagram->command = command;
+        datagram->slew = slew;
+        return transmit(datagram);
+    }
+
+    // Sends heartbeats as [client] every [interval] ms, [timeout] should
+    // allow a few of them to be lost
+    void startHeartbeat(const char *client, unsigned long interval, unsigned long timeout) {
+        memset(&heartbeat, 0, sizeof(heartbeat));
+        heartbeat.magic = GROUP_HEARTBEAT_MAGIC;
+        strncpy(heartbeat.client, client, GROUP_CLIENT_SIZE - 1);
+        heartbeat.timeout = timeout < UINT16_MAX ? timeout : UINT16_MAX;
+        heartbeatInterval = interval;
+        notify();
+    }
+
+    bool heartbeating() {
+        return 0 < heartbeatInterval;
+    }
+
+    // Sends the heartbeat if it is due, for tasks that block between loops
+    void keepAlive() {
+        if (heartbeating() && heartbeatInterval <= millis() - lastSent) sendHeartbeat();
+    }
+
+    // The latest beacon heard for the group, nullptr if none yet
+    const GroupBeacon *beaconOf(const char *group) {
+        for (int i = 0; i < beaconCount; i++)
+            if (0 == strncmp(beacons[i].group, group, GROUP_NAME_SIZE - 1)) return &beacons[i];
+        return nullptr;
+    }
+
+   protected:
+    Transport *transports[GROUP_MAX_TRANSPORTS];
+    int transportCount = 0;
+    GroupCommand latest[GROUP_SENDER_MAX_GROUPS];
+    int groupCount = 0;
+    GroupBeacon beacons[GROUP_SENDER_MAX_GROUPS];
+    int beaconCount = 0;
+    uint32_t session = 0;
+    uint32_t sequence = 0;
+    unsigned long lastRefresh = 0;
+    GroupHeartbeat heartbeat;
+    unsigned long lastSent = 0;  // ms, last frame sent, a heartbeat or a command
+
+    void loop() {
+        TRACE_SCOPE(TRACE_TRACK_LOOP, "groupSender");
+        receiveBeacons();
+        if (refreshInterval <= millis() - lastRefresh) {
+            lastRefresh = millis();
+            for (int i = 0; i < groupCount; i++)
+                transmit(&latest[i]);
+        }
+        if (0 == heartbeatInterval) {
+            sleep(pollDelay);
+            return;
+        }
+        if (heartbeatInterval <= millis() - lastSent) sendHeartbeat();
+        unsigned long wakeTime = lastSent + heartbeatInterval;
+        if (0 < (long)(wakeTime - (millis() + pollDelay))) wakeTime = millis() + pollDelay;
+        wakeAt(wakeTime);
+    }
+
+    void sendHeartbeat() {
+        for (int t = 0; t < transportCount; t++)
+            transports[t]->send((const uint8_t *)&heartbeat, sizeof(heartbeat));
+        lastSent = millis();  // also on failure, retried next interval
+    }
+
+    void receiveBeacons() {
+        uint8_t frame[TRANSPORT_FRAME_SIZE];
+        for (int t = 0; t < transportCount; t++) {
+            size_t size;
+            while (0 < (size = transports[t]->receive(frame, sizeof(frame)))) {
+                GroupBeacon *beacon = (GroupBeacon *)frame;
+                if (sizeof(GroupBeacon) != size || GROUP_BEACON_MAGIC != beacon->magic) continue;
+                beacon->host[GROUP_NAME_SIZE - 1] = '\0';
+                beacon->group[GROUP_NAME_SIZE - 1] = '\0';
+                beacon->summary[GROUP_SUMMARY_SIZE - 1] = '\0';
+                GroupBeacon *known = (GroupBeacon *)beaconOf(beacon->group);
+                bool found = nullptr == known;
+                if (found) {
+                    if (GROUP_SENDER_MAX_GROUPS <= beaconCount) continue;
+                    known = &beacons[beaconCount++];
+                }
+                memcpy(known, beacon, sizeof(GroupBeacon));
+                // the log is formatted later, from the copy that outlives frame
+                if (found) LOG_I("[Group] Found group %s on %s via %s\n", known->group, known->host, transports[t]->name);
+            }
+        }
+    }
+
+    // The latest command sent to the group, a new slot if there is none
+    GroupCommand *latestOf(const char *group) {
+        for (int i = 0; i < groupCount; i++)
+            if (0 == strncmp(latest[i].group, group, GROUP_NAME_SIZE - 1)) return &latest[i];
+        if (GROUP_SENDER_MAX_GROUPS <= groupCount) return nullptr;
+        GroupCommand *datagram = &latest[groupCount++];
+        memset(datagram, 0, sizeof(GroupCommand));
+        datagram->magic = GROUP_MAGIC;
+        strncpy(datagram->group, group, GROUP_NAME_SIZE - 1);
+        return datagram;
+    }
+
+    // Succeeds if any transport took the frame
+    bool transmit(GroupCommand *datagram) {
+        bool ok = false;
+        for (int t = 0; t < transportCount; t++)
+            ok = transports[t]->send((const uint8_t *)datagram, sizeof(GroupCommand)) || ok;
+        if (ok) {
+            sent++;
+            lastSent = millis();
+        }
+        return ok;
+    }
+} groupSender;
+
+#endif
@@ -2,33 +2,99 @@
 #define REQUEST_H
 
 #include <ESP8266HTTPClient.h>
+#include <ArduinoJson.h>  // https://github.com/bblanchon/ArduinoJson
+
+// Called after every request, so what must not wait for a slow host, like
+// the heartbeats, goes on between requests, see client.cpp
+void (*afterRequest)() = nullptr;
 
 class Request {
    public:
     int responseBufSize = 512;
+    uint16_t timeout = 250;  // ms a request may block, connecting included, see client.cpp
+    int rateHint = 0;    // X-Rate of the last response, ms between commands the host asks for
+    int retryAfter = 0;  // Retry-After of the last response, s the host asks us to wait, 0: none
 
     int requestGet(char *url, char *response) {
-        int httpCode = 0;
         WiFiClient client;
         HTTPClient http;
-        if (http.begin(client, url)) {
-            // Serial.printf("[HTTP] GET %s\n", url);
-            httpCode = http.GET();
-            if (httpCode <= 0) {
-                Serial.printf("[HTTP] GET failed, error: %s\n", http.errorToString(httpCode).c_str());
-            } else {
-                // Serial.printf("[HTTP] GET... code: %d\n", httpCode);
-                if (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_MOVED_PERMANENTLY) {
-                    snprintf(response, this->responseBufSize, http.getString().c_str());
-                    // Serial.printf("[HTTP] Response: %s\n", response);
-                }
+        if (!http.begin(client, url)) {
+            Serial.println("[HTTP] Unable to connect");
+            return 0;
+        }
+        // Serial.printf("[HTTP] GET %s\n", url);
+        return requestGet(http, response);
+    }
+
+    // Parses the response body while it is received, keeping only the
+    // fields the filter allows, so the body is never buffered
+    int requestJson(const char *url, JsonDocument &doc, JsonDocument &filter) {
+        WiFiClient client;
+        HTTPClient http;
+        if (!http.begin(client, url)) {
+            Serial.println("[HTTP] Unable to connect");
+            return 0;
+        }
+        http.setTimeout(timeout);
+        int httpCode = http.GET();
+        if (httpCode <= 0) {
+            Serial.printf("[HTTP] GET failed, error: %s\n", http.errorToString(httpCode).c_str());
+        } else if (httpCode == HTTP_CODE_OK) {
+            DeserializationError error = deserializeJson(doc, http.getStream(), DeserializationOption::Filter(filter));
+            if (error) {
+                Serial.printf("[HTTP] JSON error: %s\n", error.c_str());
+                httpCode = 0;
             }
-            http.end();
+        }
+        http.end();
+        if (nullptr != afterRequest) afterRequest();
+        return httpCode;
+    }
+
+    // GET on an HTTPClient that has already been begun
+    int requestGet(HTTPClient &http, char *response) {
+        const char *headers[] = {"X-Rate", "Retry-After"};
+        http.collectHeaders(headers, 2);
+        http.setTimeout(timeout);
+        int httpCode = http.GET();
+        if (httpCode <= 0) {
+            Serial.printf("[HTTP] GET failed, error: %s\n", http.errorToString(httpCode).c_str());
         } else {
-            Serial.println("[HTTP] Unable to connect");
+            // Serial.printf("[HTTP] GET... code: %d\n", httpCode);
+            rateHint = http.header("X-Rate").toInt();
+            retryAfter = http.header("Retry-After").toInt();
+            if (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_MOVED_PERMANENTLY) {
+                snprintf(response, this->responseBufSize, "%s", http.getString().c_str());
+                // Serial.printf("[HTTP] Response: %s\n", response);
+            }
         }
+        http.end();
+        if (nullptr != afterRequest) afterRequest();
         return httpCode;
     }
 };
 
-#endif
\ No newline at end of file
+// Requests to one host, and what it told us last. Each request connects
+// anew: the server's AsyncWebServer answers one request per connection,
+// and its admission counts a request until the connection closes, see
+// server/src/admission.h. A connection kept open would hold a slot there.
+class Connection : public Request {
+   public:
+    IPAddress ip;
+    int port = 0;
+
+    int requestGet(const char *path, char *response) {
+        http.setReuse(false);
+        if (!http.begin(client, ip.toString(), port, path)) {
+            Serial.println("[HTTP] Unable to connect");
+            return 0;
+        }
+        return Request::requestGet(http, response);
+    }
+
+   private:
+    WiFiClient client;
+    HTTPClient http;
+};
+
+#endif
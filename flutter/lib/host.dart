@@ -79,10 +79,13 @@ class Host {
       });
       responseBody = response.body;
       statusCode = response.statusCode;
+      // the server adapts the command rate to its load
+      int? serverRate = int.tryParse(response.headers['x-rate'] ?? '');
+      if (null != serverRate && 0 < serverRate) rate = serverRate;
     } catch (e) {
       //debugPrint("[HTTP] ${e.toString()}");
     }
-    if (statusCode == 200) {
+    if (statusCode == 200 || statusCode == 204) {
       debugPrint("[HTTP] Request to $path OK, response: $responseBody");
       return responseBody;
     } else {
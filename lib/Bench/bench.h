@@ -0,0 +1,44 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <Arduino.h>
+
+#include <heapmonitor.h>
+
+// Microbenchmarks for the per-step and per-command paths. Each run prints
+// one JSON line, so results can be collected from the serial console and
+// compared between builds:
+//     {"bench":"calculatePause","iterations":1000,"cycles":412,"allocations":0}
+// cycles is per call, allocations is the total over all iterations, counted
+// when the firmware is linked with the allocation wrappers, see HeapMonitor.
+// Output sink for benchmarking serialization
+class NullPrint : public Print {
+   public:
+    size_t write(uint8_t) {
+        return 1;
+    }
+    size_t write(const uint8_t *, size_t size) {
+        return size;
+    }
+};
+
+class Bench {
+   public:
+    Print *out = &Serial;
+
+    template <typename F>
+    void run(const char *name, int iterations, F f) {
+        f();  // warm up the flash cache
+        uint32_t allocations = heapAllocations;
+        uint32_t start = ESP.getCycleCount();
+        for (int i = 0; i < iterations; i++)
+            f();
+        uint32_t cycles = ESP.getCycleCount() - start;
+        allocations = heapAllocations - allocations;
+        out->printf("{\"bench\":\"%s\",\"iterations\":%d,\"cycles\":%u,\"allocations\":%u}\n",
+                    name, iterations, cycles / iterations, allocations);
+        yield();
+    }
+};
+
+#endif
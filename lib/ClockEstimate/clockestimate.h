@@ -0,0 +1,65 @@
+#ifndef CLOCKESTIMATE_H
+#define CLOCKESTIMATE_H
+
+#include <stdint.h>
+
+// Estimate of another device's micros() clock from round trips, NTP style:
+// of a sync's samples the one with the shortest round trip is kept, the
+// other clock's reading is taken to be from the middle of it, so the error
+// is at most half the asymmetry of that round trip. Drift is the change of
+// the offset between syncs at least minDriftSpan apart. Plain arithmetic,
+// see ClockSync for the requests.
+class ClockEstimate {
+   public:
+    uint32_t minDriftSpan = 10000000;  // us between syncs needed to measure drift
+    bool synced = false;
+    int32_t offset = 0;  // us, other minus local clock at refLocal
+    float drift = 0;     // us the other clock gains per local us
+    uint32_t rtt = 0;    // us, round trip of the sample in use
+
+    // The other clock at local micros() [local]
+    uint32_t hostTime(uint32_t local) {
+        return local + offset + (int32_t)(drift * (int32_t)(local - refLocal));
+    }
+
+    // Starts collecting the samples of a sync
+    void begin() {
+        bestRtt = UINT32_MAX;
+    }
+
+    // A round trip sent at local [t0], answered with the other clock's
+    // [host], received at local [t3]
+    void sample(uint32_t t0, uint32_t host, uint32_t t3) {
+        if (bestRtt <= t3 - t0) return;
+        bestRtt = t3 - t0;
+        bestLocal = t0 + bestRtt / 2;
+        bestOffset = host - bestLocal;
+    }
+
+    // Takes the best sample since begin(), false if there was none
+    bool end() {
+        if (UINT32_MAX == bestRtt) return false;
+        uint32_t span = bestLocal - refLocal;
+        if (synced && minDriftSpan <= span) {
+            float measured = (float)(int32_t)(bestOffset - offset) / span;
+            drift = measuredDrift ? drift + (measured - drift) / 4 : measured;
+            measuredDrift = true;
+        }
+        if (!synced || minDriftSpan <= span) {
+            offset = bestOffset;
+            refLocal = bestLocal;
+        }
+        rtt = bestRtt;
+        synced = true;
+        return true;
+    }
+
+   private:
+    uint32_t refLocal = 0;
+    bool measuredDrift = false;
+    uint32_t bestRtt = UINT32_MAX;
+    uint32_t bestLocal = 0;
+    int32_t bestOffset = 0;
+};
+
+#endif
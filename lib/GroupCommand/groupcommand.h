@@ -0,0 +1,55 @@
+#ifndef GROUPCOMMAND_H
+#define GROUPCOMMAND_H
+
+#include <Arduino.h>
+
+// One frame per change drives every device subscribed to a group, however
+// many servers they are on. Frames go over any Transport, see transport.h,
+// UDP multicast uses the address and port below.
+#define GROUP_PORT 50124
+#define GROUP_ADDRESS IPAddress(239, 255, 50, 124)  // administratively scoped
+#define GROUP_MAGIC 0x31435345                     // "ESC1", bump the digit when the layout changes
+#define GROUP_NAME_SIZE 16
+#define GROUP_CLIENT_SIZE 9
+
+// Both ends are ESP8266s, the struct goes on the wire as it is in memory.
+// A sender numbers its changes, and repeats the latest one per group at a
+// fixed interval so receivers recover from lost datagrams. Receivers drop
+// sequence numbers they have already seen, the session tells a restarted
+// sender from an old one.
+struct GroupCommand {
+    uint32_t magic;
+    uint32_t session;   // random, picked by the sender at boot
+    uint32_t sequence;  // increases with every change the sender makes
+    char group[GROUP_NAME_SIZE];
+    char client[GROUP_CLIENT_SIZE];  // sender id, same as the "client" parameter of /api/control
+    int32_t command;
+    uint32_t slew;  // ms, 0: at once
+} __attribute__((packed));
+
+#define GROUP_HEARTBEAT_MAGIC 0x31485345  // "ESH1"
+
+// Sent by a remote every few hundred ms while it is alive. A server that
+// leased devices to the remote renews the leases, and stops the devices once
+// no heartbeat or command came for [timeout] ms, so a remote that is gone
+// is noticed long before any watchdog. Any command also counts as one.
+struct GroupHeartbeat {
+    uint32_t magic;
+    char client[GROUP_CLIENT_SIZE];  // sender id, same as the "client" parameter of /api/control
+    uint16_t timeout;                // ms of silence after which the sender counts as lost
+} __attribute__((packed));
+
+#define GROUP_BEACON_MAGIC 0x31425345  // "ESB1"
+#define GROUP_SUMMARY_SIZE 48
+
+// Broadcast by servers for every device that follows a group, so remotes
+// discover groups without mDNS or HTTP
+struct GroupBeacon {
+    uint32_t magic;
+    char host[GROUP_NAME_SIZE];
+    char group[GROUP_NAME_SIZE];
+    int32_t rate;                      // ms between commands the server asks for
+    char summary[GROUP_SUMMARY_SIZE];  // "name,type[,commandMin,commandMax]" as in the mDNS TXT record
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef HEAPMONITOR_H
+#define HEAPMONITOR_H
+
+#include <Arduino.h>
+
+#define HEAPMONITOR_MAX_HANDLERS 16
+
+// Number of malloc/realloc/calloc calls since boot. Counted only when the
+// firmware is linked with -Wl,--wrap=malloc,--wrap=realloc,--wrap=calloc
+// and HEAP_COUNT_ALLOCATIONS is defined, see platformio.ini.
+volatile uint32_t heapAllocations = 0;
+
+#ifdef HEAP_COUNT_ALLOCATIONS
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_calloc(size_t count, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    heapAllocations = heapAllocations + 1;
+    return __real_malloc(size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    heapAllocations = heapAllocations + 1;
+    return __real_realloc(ptr, size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    heapAllocations = heapAllocations + 1;
+    return __real_calloc(count, size);
+}
+}
+#endif
+
+struct HandlerHeapStats {
+    const char *name;
+    uint32_t calls;
+    uint32_t allocations;  // total over all calls
+    int32_t retained;      // heap still held when the handlers returned, includes responses sent later
+};
+
+// Heap and fragmentation samples plus per-handler allocation counters
+class HeapMonitor {
+   public:
+    uint32_t freeHeap = 0;
+    uint32_t maxFreeBlock = 0;
+    uint8_t fragmentation = 0;  // %
+    uint32_t minFreeHeap = UINT32_MAX;
+    uint32_t minMaxFreeBlock = UINT32_MAX;
+    uint8_t maxFragmentation = 0;
+    HandlerHeapStats handlers[HEAPMONITOR_MAX_HANDLERS];
+    int handlerCount = 0;
+
+    void sample() {
+        freeHeap = ESP.getFreeHeap();
+        maxFreeBlock = ESP.getMaxFreeBlockSize();
+        fragmentation = ESP.getHeapFragmentation();
+        if (freeHeap < minFreeHeap) minFreeHeap = freeHeap;
+        if (maxFreeBlock < minMaxFreeBlock) minMaxFreeBlock = maxFreeBlock;
+        if (maxFragmentation < fragmentation) maxFragmentation = fragmentation;
+    }
+
+    HandlerHeapStats *addHandler(const char *name) {
+        if (HEAPMONITOR_MAX_HANDLERS <= handlerCount) return nullptr;
+        HandlerHeapStats *stats = &handlers[handlerCount];
+        stats->name = name;
+        stats->calls = 0;
+        stats->allocations = 0;
+        stats->retained = 0;
+        handlerCount++;
+        return stats;
+    }
+} heapMonitor;
+
+// Counts the allocations made during its lifetime into a handler's stats:
+//     HeapProbe probe(statsControl);
+class HeapProbe {
+   public:
+    HeapProbe(HandlerHeapStats *stats) {
+        this->stats = stats;
+        allocations = heapAllocations;
+        freeHeap = ESP.getFreeHeap();
+    }
+
+    ~HeapProbe() {
+        if (nullptr == stats) return;
+        stats->calls++;
+        stats->allocations += heapAllocations - allocations;
+        stats->retained += (int32_t)freeHeap - (int32_t)ESP.getFreeHeap();
+    }
+
+   protected:
+    HandlerHeapStats *stats;
+    uint32_t allocations;
+    uint32_t freeHeap;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <Arduino.h>
+
+#define HISTOGRAM_BUCKETS 24  // bucket i counts values below 2^i, the last one the rest
+
+// Distribution of durations in power of two buckets: fixed size, no
+// allocation and cheap enough to record from the step loop. Percentiles are
+// reported as the upper bound of the bucket they fall in, i.e. at most twice
+// the exact value.
+class Histogram {
+   public:
+    uint32_t count = 0;
+    uint32_t max = 0;
+    uint64_t sum = 0;
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+
+    Histogram() {
+        reset();
+    }
+
+    void reset() {
+        count = 0;
+        max = 0;
+        sum = 0;
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+            buckets[i] = 0;
+    }
+
+    inline void IRAM_ATTR record(uint32_t value) {
+        int bucket = 0 == value ? 0 : 32 - __builtin_clz(value);
+        if (HISTOGRAM_BUCKETS <= bucket) bucket = HISTOGRAM_BUCKETS - 1;
+        buckets[bucket]++;
+        count++;
+        sum += value;
+        if (max < value) max = value;
+    }
+
+    uint32_t mean() {
+        return 0 == count ? 0 : sum / count;
+    }
+
+    // Upper bound of the value [percent] of the recorded ones are below, capped at max
+    uint32_t percentile(int percent) {
+        if (0 == count) return 0;
+        uint32_t rank = ((uint64_t)count * percent + 99) / 100;
+        uint32_t seen = 0;
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            seen += buckets[i];
+            if (rank <= seen && i < HISTOGRAM_BUCKETS - 1) {
+                uint32_t bound = (1UL << i) - 1;
+                return bound < max ? bound : max;
+            }
+        }
+        return max;
+    }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+#include <tickless.h>
+#include <type_traits>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+// Messages above this level are compiled out
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Number of records in the ring buffer, power of 2
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 32
+#endif
+
+#define LOG_MAX_ARGS 10
+#define LOG_LINE_SIZE 160
+
+// One deferred message: the format string pointer and the raw arguments,
+// formatting happens when the record is drained.
+struct LogRecord {
+    const char *format;
+    uint8_t argc;
+    uintptr_t args[LOG_MAX_ARGS];
+};
+
+// Lock-free single producer, single consumer ring of log records. Tasks are
+// cooperative, so all tasks together count as the single producer; do not
+// log from ISRs. Records that do not fit are dropped and counted.
+class LogBuffer {
+   public:
+    volatile uint32_t dropped = 0;
+
+    template <typename... Args>
+    void write(const char *format, Args... args) {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many log arguments");
+        uint32_t h = head;
+        if (LOG_BUFFER_SIZE <= h - tail) {
+            dropped++;
+            return;
+        }
+        LogRecord &record = records[h % LOG_BUFFER_SIZE];
+        record.format = format;
+        record.argc = sizeof...(Args);
+        store(record.args, args...);
+        head = h + 1;
+    }
+
+    bool empty() {
+        return head == tail;
+    }
+
+    // Formats the oldest record into buf without removing it,
+    // returns the length or -1 if the buffer is empty
+    int peek(char *buf, size_t size) {
+        if (empty()) return -1;
+        const LogRecord &r = records[tail % LOG_BUFFER_SIZE];
+        return snprintf(buf, size, r.format,
+                        r.args[0], r.args[1], r.args[2], r.args[3],
+                        r.args[4], r.args[5], r.args[6], r.args[7],
+                        r.args[8], r.args[9]);
+    }
+
+    void pop() {
+        if (!empty()) tail = tail + 1;
+    }
+
+   protected:
+    LogRecord records[LOG_BUFFER_SIZE];
+    volatile uint32_t head = 0;
+    volatile uint32_t tail = 0;
+
+    // Arguments are kept as raw words: integers, and pointers to strings that
+    // outlive the record (literals, names). Temporaries like
+    // String::c_str() must not be passed.
+    template <typename T>
+    static uintptr_t pack(T value) {
+        static_assert((std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value) &&
+                          sizeof(T) <= sizeof(uintptr_t),
+                      "Deferred log arguments must be integers or pointers");
+        return (uintptr_t)value;
+    }
+
+    void store(uintptr_t *) {}
+
+    template <typename T, typename... Rest>
+    void store(uintptr_t *slot, T value, Rest... rest) {
+        *slot = pack(value);
+        store(slot + 1, rest...);
+    }
+};
+
+LogBuffer logBuffer;
+
+#if LOG_LEVEL_ERROR <= LOG_LEVEL
+#define LOG_E(...) logBuffer.write(__VA_ARGS__)
+#else
+#define LOG_E(...) \
+    do {           \
+    } while (0)
+#endif
+
+#if LOG_LEVEL_WARN <= LOG_LEVEL
+#define LOG_W(...) logBuffer.write(__VA_ARGS__)
+#else
+#define LOG_W(...) \
+    do {           \
+    } while (0)
+#endif
+
+#if LOG_LEVEL_INFO <= LOG_LEVEL
+#define LOG_I(...) logBuffer.write(__VA_ARGS__)
+#else
+#define LOG_I(...) \
+    do {           \
+    } while (0)
+#endif
+
+#if LOG_LEVEL_DEBUG <= LOG_LEVEL
+#define LOG_D(...) logBuffer.write(__VA_ARGS__)
+#else
+#define LOG_D(...) \
+    do {           \
+    } while (0)
+#endif
+
+// Drains the log buffer to the serial port, only as much as fits into the
+// UART FIFO, so logging never blocks the other tasks. A line longer than
+// the free space goes out in pieces over several passes, lines longer than
+// LOG_LINE_SIZE are cut.
+class LogTask : public DeadlineTask {
+   public:
+    int drainDelay = 20;  // ms
+
+   protected:
+    uint32_t droppedReported = 0;
+    int written = 0;  // chars of the oldest record already on the wire
+
+    void loop() {
+        char line[LOG_LINE_SIZE];
+        int len;
+        while (0 <= (len = logBuffer.peek(line, sizeof(line)))) {
+            if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+            int free = Serial.availableForWrite();
+            if (free <= 0) break;
+            int piece = len - written < free ? len - written : free;
+            Serial.write(line + written, piece);
+            written += piece;
+            if (written < len) break;
+            written = 0;
+            logBuffer.pop();
+        }
+        if (droppedReported != logBuffer.dropped && logBuffer.empty()) {
+            uint32_t dropped = logBuffer.dropped;
+            len = snprintf(line, sizeof(line), "[Log] %u messages dropped\n", dropped);
+            if (len <= Serial.availableForWrite()) {
+                Serial.write(line, len);
+                droppedReported = dropped;
+            }
+        }
+        sleep(drainDelay);
+    }
+} logTask;
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef PINCAPTURE_H
+#define PINCAPTURE_H
+
+#include <Arduino.h>
+
+// Logic analyzer in firmware: the output pins of steppers and LEDs are
+// recorded where the firmware writes them, timed with the CPU cycle
+// counter, and exported as a VCD file that waveform viewers like GTKWave
+// or PulseView open. Compiled in with -DPIN_CAPTURE only, see the capture
+// environment in platformio.ini and test_pincapture in test/Makefile;
+// otherwise the CAPTURE_ macros expand to nothing. Edges written by hardware, e.g. the I2S stepper's DMA, are not
+// seen.
+//
+// A capture is one shot: arm() notes the level of every channel and
+// records until the buffer is full or maxDuration has passed, so the
+// timestamps do not wrap.
+#ifndef CAPTURE_SIZE
+#define CAPTURE_SIZE 1024  // edges, 8 bytes each
+#endif
+#define CAPTURE_MAX_CHANNELS 8
+#define CAPTURE_TIMESCALE_NS 100  // VCD time unit
+
+struct CaptureEdge {
+    uint32_t cycles;  // ESP.getCycleCount()
+    uint8_t channel;
+    uint8_t level;
+};
+
+#define CAPTURE_MAX_WINDOWS 32
+
+// Timing of a step and direction interface, derived from a capture
+struct StepMetrics {
+    uint32_t steps = 0;              // rising edges of the pulse pin
+    uint32_t pulseWidthMin = 0;      // ns
+    uint32_t pulseWidthMax = 0;      // ns
+    uint32_t widthViolations = 0;    // pulses shorter than required
+    uint32_t directionChanges = 0;
+    uint32_t setupMin = 0;           // ns from a direction change to the next pulse
+    uint32_t setupViolations = 0;    // pulses closer to a direction change than required
+    uint32_t windowNs = 0;           // length of a frequency window
+    int windowCount = 0;
+    uint16_t stepsPerWindow[CAPTURE_MAX_WINDOWS];  // steps in consecutive windows from arming
+};
+
+struct CaptureChannel {
+    uint8_t pin;
+    const char *device;  // name of the device writing the pin
+    const char *signal;  // e.g. "pulse"
+    uint8_t initial;     // level when armed
+};
+
+class PinCapture {
+   public:
+    CaptureChannel channels[CAPTURE_MAX_CHANNELS];
+    int channelCount = 0;
+    CaptureEdge edges[CAPTURE_SIZE];
+    uint32_t count = 0;
+    bool armed = false;
+    uint32_t startCycles = 0;
+    unsigned long maxDuration = 4000;  // ms, keeps the times in ns within 32 bits
+
+    // Pins are captured once they have a channel, [device] and [signal] name it
+    bool addChannel(uint8_t pin, const char *device, const char *signal) {
+        if (0 <= channelOf(pin)) return true;
+        if (CAPTURE_MAX_CHANNELS <= channelCount) return false;
+        channels[channelCount] = {pin, device, signal, 0};
+        channelCount++;
+        return true;
+    }
+
+    inline int IRAM_ATTR channelOf(uint8_t pin) {
+        for (int i = 0; i < channelCount; i++)
+            if (pin == channels[i].pin) return i;
+        return -1;
+    }
+
+    void arm() {
+        armed = false;
+        for (int i = 0; i < channelCount; i++)
+            channels[i].initial = digitalRead(channels[i].pin);
+        count = 0;
+        startCycles = ESP.getCycleCount();
+        startMillis = millis();
+        armed = true;
+    }
+
+    inline void IRAM_ATTR record(uint8_t pin, uint8_t level) {
+        if (!armed) return;
+        uint32_t cycles = ESP.getCycleCount();
+        int channel = channelOf(pin);
+        if (channel < 0) return;
+        if (CAPTURE_SIZE <= count || maxDuration < millis() - startMillis) {
+            armed = false;
+            return;
+        }
+        edges[count++] = {cycles, (uint8_t)channel, level};
+    }
+
+    // For the GPIO set and clear registers, records the pin of a one pin [mask]
+    inline void IRAM_ATTR recordMask(uint32_t mask, uint8_t level) {
+        record(__builtin_ctz(mask), level);
+    }
+
+    // ns from arming to [cycles]
+    uint32_t nanos(uint32_t cycles) {
+        return (uint64_t)(cycles - startCycles) * 1000 / ESP.getCpuFreqMHz();
+    }
+
+    // Measures the pulses on [pulsePin] against [pulseWidth] and their
+    // distance to edges on [directionPin] against [setupTime], both in ns,
+    // and counts the steps in windows of [windowNs]. Edges are timed just
+    // after their register write, so widths are good to a few cycles.
+    StepMetrics stepMetrics(uint8_t pulsePin, uint8_t directionPin,
+                            uint32_t pulseWidth, uint32_t setupTime, uint32_t windowNs) {
+        StepMetrics m;
+        m.windowNs = windowNs;
+        for (int i = 0; i < CAPTURE_MAX_WINDOWS; i++)
+            m.stepsPerWindow[i] = 0;
+        int pulse = channelOf(pulsePin);
+        int direction = channelOf(directionPin);
+        if (pulse < 0) return m;
+        bool high = channels[pulse].initial;
+        int directionLevel = 0 <= direction ? channels[direction].initial : -1;
+        uint32_t riseTime = 0;
+        bool directionPending = false;
+        uint32_t directionTime = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            const CaptureEdge &e = edges[i];
+            uint32_t time = nanos(e.cycles);
+            if (e.channel == direction) {
+                if (e.level == directionLevel) continue;  // rewritten, not changed
+                directionLevel = e.level;
+                m.directionChanges++;
+                directionPending = true;
+                directionTime = time;
+                continue;
+            }
+            if (e.channel != pulse || (bool)e.level == high) continue;
+            high = e.level;
+            if (high) {
+                riseTime = time;
+                m.steps++;
+                uint32_t window = 0 == windowNs ? 0 : time / windowNs;
+                if (window < CAPTURE_MAX_WINDOWS) {
+                    m.stepsPerWindow[window]++;
+                    if (m.windowCount <= (int)window) m.windowCount = window + 1;
+                }
+                if (directionPending) {
+                    uint32_t setup = time - directionTime;
+                    if (0 == m.setupMin || setup < m.setupMin) m.setupMin = setup;
+                    if (setup < setupTime) m.setupViolations++;
+                    directionPending = false;
+                }
+            } else if (0 < m.steps) {
+                uint32_t width = time - riseTime;
+                if (0 == m.pulseWidthMin || width < m.pulseWidthMin) m.pulseWidthMin = width;
+                if (m.pulseWidthMax < width) m.pulseWidthMax = width;
+                if (width < pulseWidth) m.widthViolations++;
+            }
+        }
+        return m;
+    }
+
+    // Stops capturing until the next arm(), so the edges read stay put
+    void beginExport() {
+        armed = false;
+        exportState = EXPORT_HEADER;
+        exportIndex = 0;
+        lineLen = 0;
+        linePos = 0;
+    }
+
+    // Fills [buf] with the next part of the VCD export, returns the length,
+    // 0 once it is complete. Call beginExport() first.
+    size_t read(uint8_t *buf, size_t size) {
+        size_t len = 0;
+        while (len < size) {
+            if (linePos == lineLen && !nextLine()) break;
+            size_t n = lineLen - linePos < size - len ? lineLen - linePos : size - len;
+            memcpy(buf + len, line + linePos, n);
+            linePos += n;
+            len += n;
+        }
+        return len;
+    }
+
+   protected:
+    enum { EXPORT_HEADER,
+           EXPORT_VARS,
+           EXPORT_INITIAL,
+           EXPORT_EDGES,
+           EXPORT_DONE };
+
+    unsigned long startMillis = 0;
+    int exportState = EXPORT_HEADER;
+    uint32_t exportIndex = 0;
+    uint32_t lastTime = 0;
+    char line[96];
+    size_t lineLen = 0;
+    size_t linePos = 0;
+
+    // VCD identifier of a channel
+    char id(int channel) {
+        return '!' + channel;
+    }
+
+    bool nextLine() {
+        int len = 0;
+        switch (exportState) {
+            case EXPORT_HEADER:
+                len = snprintf(line, sizeof(line), "$timescale %d ns $end\n$scope module esp8266 $end\n",
+                               CAPTURE_TIMESCALE_NS);
+                exportState = EXPORT_VARS;
+                break;
+            case EXPORT_VARS:
+                if (exportIndex < (uint32_t)channelCount) {
+                    const CaptureChannel &c = channels[exportIndex];
+                    len = snprintf(line, sizeof(line), "$var wire 1 %c %s.%s $end\n",
+                                   id(exportIndex), c.device, c.signal);
+                    exportIndex++;
+                } else {
+                    len = snprintf(line, sizeof(line), "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+                    exportState = EXPORT_INITIAL;
+                    exportIndex = 0;
+                }
+                break;
+            case EXPORT_INITIAL:
+                if (exportIndex < (uint32_t)channelCount) {
+                    len = snprintf(line, sizeof(line), "%u%c\n", channels[exportIndex].initial, id(exportIndex));
+                    exportIndex++;
+                } else {
+                    len = snprintf(line, sizeof(line), "$end\n");
+                    exportState = EXPORT_EDGES;
+                    exportIndex = 0;
+                    lastTime = 0;
+                }
+                break;
+            case EXPORT_EDGES:
+                if (count <= exportIndex) {
+                    exportState = EXPORT_DONE;
+                    return false;
+                } else {
+                    const CaptureEdge &e = edges[exportIndex++];
+                    uint32_t time = nanos(e.cycles) / CAPTURE_TIMESCALE_NS;
+                    if (time == lastTime && 1 < exportIndex)
+                        len = snprintf(line, sizeof(line), "%u%c\n", e.level, id(e.channel));
+                    else
+                        len = snprintf(line, sizeof(line), "#%u\n%u%c\n", time, e.level, id(e.channel));
+                    lastTime = time;
+                }
+                break;
+            default:
+                return false;
+        }
+        lineLen = len < (int)sizeof(line) ? len : sizeof(line) - 1;
+        linePos = 0;
+        return true;
+    }
+};
+
+#ifdef PIN_CAPTURE
+PinCapture pinCapture;
+
+#define CAPTURE_CHANNEL(pin, device, signal) pinCapture.addChannel(pin, device, signal)
+#define CAPTURE_WRITE(pin, level) pinCapture.record(pin, level)
+#define CAPTURE_MASK(mask, level) pinCapture.recordMask(mask, level)
+#else
+#define CAPTURE_CHANNEL(pin, device, signal)
+#define CAPTURE_WRITE(pin, level)
+#define CAPTURE_MASK(mask, level)
+#endif
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef REMOTECOMMAND_H
+#define REMOTECOMMAND_H
+
+#include <Arduino.h>
+
+// The remote's way from inputs to requests, as plain functions: averaging
+// pot readings, mapping them to commands, formatting the /api/control path
+// and reading a host's config from its mDNS TXT record. The client's
+// devices and Config call them, the host bench times them, see
+// test/bench.cpp.
+
+#define MDNS_TXT_VERSION 1  // must match the server
+#define TXT_MAX_DEVICES 32
+
+// Mean of [count] readings adding up to [total], kept within [min]..[max]
+inline int averageReading(long total, int count, int min, int max) {
+    long mean = total / count;
+    return mean < min ? min : max < mean ? max : mean;
+}
+
+// A pot's [value] in [min]..[max] as a command in [commandMin]..[commandMax]
+inline int potCommand(int value, int min, int max, int commandMin, int commandMax) {
+    return map(value, min, max, commandMin, commandMax);
+}
+
+// A pot for the speed with switches for enable and direction: 0 while
+// disabled, otherwise from 1 at the pot's low end, or -1 [backwards], to
+// [commandMax], or [commandMin] backwards, at its high end. [invert] swaps
+// the pot's ends.
+inline int potDirectionCommand(int value, int min, int max, bool invert, bool enabled, bool backwards,
+                               int commandMin, int commandMax) {
+    if (!enabled) return 0;
+    int inMin = invert ? max : min;
+    int inMax = invert ? min : max;
+    return backwards ? map(value, inMin, inMax, -1, commandMin) : map(value, inMin, inMax, 1, commandMax);
+}
+
+// The /api/control path commanding [device], [at] 0 for on arrival,
+// returns its length like snprintf()
+inline int formatCommandPath(char *buf, size_t size, const char *device, int command, unsigned long slew, uint32_t at,
+                             const char *client, int priority) {
+    char atParam[16] = "";
+    if (0 < at) snprintf(atParam, sizeof(atParam), "&at=%u", at);
+    return snprintf(buf, size, "/api/control?device=%s&command=%i&slew=%lu%s&client=%s&priority=%i",
+                    device, command, slew, atParam, client, priority);
+}
+
+struct TxtDevice {
+    const char *name;
+    const char *type;
+    bool range;  // commandMin and commandMax are set
+    int commandMin;
+    int commandMax;
+};
+
+// A host's config as its TXT record has it
+struct TxtConfig {
+    int version = 0;
+    int rate = -1;  // -1: missing
+    unsigned long lease = 0;
+    bool hasLease = false;
+    int count = -1;  // devices the host has, -1: missing
+    int found = 0;   // devices in the record
+    TxtDevice devices[TXT_MAX_DEVICES];
+
+    // From this version, with a rate and every device
+    bool usable() const {
+        return MDNS_TXT_VERSION == version && 0 <= rate && count == found && found <= TXT_MAX_DEVICES;
+    }
+};
+
+// Parses a TXT answer ("v=1;rate=200;lease=5000;n=1;d0=Stepper1,stepper,-1024,1024")
+// in place, the names point into [txts]. Returns conf.usable().
+inline bool parseTxtConfig(char *txts, TxtConfig &conf) {
+    char *savePair;
+    for (char *pair = strtok_r(txts, ";", &savePair); nullptr != pair; pair = strtok_r(nullptr, ";", &savePair)) {
+        char *value = strchr(pair, '=');
+        if (nullptr == value) continue;
+        *value++ = '\0';
+        if (0 == strcmp(pair, "v")) {
+            conf.version = atoi(value);
+        } else if (0 == strcmp(pair, "rate")) {
+            conf.rate = atoi(value);
+        } else if (0 == strcmp(pair, "lease")) {
+            conf.lease = strtoul(value, nullptr, 10);
+            conf.hasLease = true;
+        } else if (0 == strcmp(pair, "n")) {
+            conf.count = atoi(value);
+        } else if ('d' == pair[0] && isdigit(pair[1])) {
+            char *saveField;
+            char *name = strtok_r(value, ",", &saveField);
+            char *type = strtok_r(nullptr, ",", &saveField);
+            if (nullptr == name || nullptr == type) continue;
+            char *commandMin = strtok_r(nullptr, ",", &saveField);
+            char *commandMax = strtok_r(nullptr, ",", &saveField);
+            if (conf.found < TXT_MAX_DEVICES) {
+                TxtDevice &device = conf.devices[conf.found];
+                device.name = name;
+                device.type = type;
+                device.range = nullptr != commandMin && nullptr != commandMax;
+                device.commandMin = device.range ? atoi(commandMin) : 0;
+                device.commandMax = device.range ? atoi(commandMax) : 0;
+            }
+            conf.found++;
+        }
+    }
+    return conf.usable();
+}
+
+#endif
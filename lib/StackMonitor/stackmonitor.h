@@ -0,0 +1,55 @@
+#ifndef STACKMONITOR_H
+#define STACKMONITOR_H
+
+#include <Arduino.h>
+#include <Scheduler.h>  // https://github.com/nrwiersma/ESP8266Scheduler
+#include <Task.h>
+#include <cont.h>
+
+#define STACKMONITOR_MAX_TASKS 16
+
+// Stack high-water marks of the tasks that have their own stack.
+// The core paints every continuation stack with CONT_STACKGUARD when it is
+// initialized, the words that still hold the pattern have never been used.
+// Tasks keep their cont_t private, so it is found by scanning the task
+// object for the first guard word (stack_guard1), the stack follows it.
+class StackMonitor {
+   public:
+    const char *names[STACKMONITOR_MAX_TASKS];
+    Task *tasks[STACKMONITOR_MAX_TASKS];
+    int taskCount = 0;
+
+    bool add(const char *name, Task *task) {
+        if (STACKMONITOR_MAX_TASKS <= taskCount) return false;
+        names[taskCount] = name;
+        tasks[taskCount] = task;
+        taskCount++;
+        return true;
+    }
+
+    // Bytes of the task's stack never used so far, -1 if the stack was not found
+    static int freeStack(Task *task) {
+        const uint32_t *word = (const uint32_t *)task;
+        const uint32_t *end = (const uint32_t *)((const uint8_t *)task + sizeof(Task));
+        while (word < end && CONT_STACKGUARD != *word) word++;
+        if (end <= word) return -1;
+        word++;  // stack_guard1
+        int freeWords = 0;
+        while (word < end && CONT_STACKGUARD == *word) {
+            word++;
+            freeWords++;
+        }
+        return freeWords * 4;
+    }
+
+    int freeStack(int i) {
+        return freeStack(tasks[i]);
+    }
+
+    // Unused stack of the loop context, shared by setup(), loop() and all LeanTasks
+    static int freeMainStack() {
+        return ESP.getFreeContStack();
+    }
+} stackMonitor;
+
+#endif
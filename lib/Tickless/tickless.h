@@ -0,0 +1,118 @@
+#ifndef TICKLESS_H
+#define TICKLESS_H
+
+#include <Arduino.h>
+#include <Scheduler.h>  // https://github.com/nrwiersma/ESP8266Scheduler
+#include <LeanTask.h>
+
+#define TICKLESS_MAX_TASKS 16
+#define TICKLESS_FOREVER 0x7FFFFFFF
+
+class DeadlineTask;
+
+// Knows the wakeup time of every DeadlineTask, so the idle task can sleep
+// until the earliest one instead of spinning through the scheduler.
+class Tickless {
+   public:
+    DeadlineTask *tasks[TICKLESS_MAX_TASKS];
+    int taskCount = 0;
+    volatile int awake = 0;  // number of holders that need the CPU running, e.g. a stepping motor
+
+    bool add(DeadlineTask *task) {
+        if (TICKLESS_MAX_TASKS <= taskCount) return false;
+        tasks[taskCount] = task;
+        taskCount++;
+        return true;
+    }
+
+    // Milliseconds until the earliest deadline, 0 if a task is due now
+    unsigned long nextWakeup(unsigned long now, unsigned long max);
+} tickless;
+
+// Task without its own stack that only runs when its deadline has passed or
+// it has been notified. Instead of delay(), loop() ends with sleep(),
+// wakeAt() or waitForEvent(); if it does none of these, it runs again on
+// the next scheduler pass.
+class DeadlineTask : public LeanTask {
+   public:
+    DeadlineTask() {
+        tickless.add(this);
+    }
+
+    void wakeAt(unsigned long time) {
+        wakeTime = time;
+        scheduled = true;
+    }
+
+    void sleep(unsigned long ms) {
+        wakeAt(millis() + ms);
+    }
+
+    // Sleeps until notify() is called or the timeout passes
+    void waitForEvent(unsigned long timeout = TICKLESS_FOREVER) {
+        sleep(timeout);
+    }
+
+    // Wakes the task on the next scheduler pass, safe to call from an ISR
+    void notify() {
+        notified = true;
+    }
+
+    bool due(unsigned long now) {
+        return notified || !scheduled || 0 <= (long)(now - wakeTime);
+    }
+
+    unsigned long wakeTime = 0;
+
+   protected:
+    volatile bool notified = false;
+    bool scheduled = false;
+
+    bool shouldRun() {
+        if (!due(millis())) return false;
+        notified = false;
+        scheduled = false;
+        return true;
+    }
+};
+
+unsigned long Tickless::nextWakeup(unsigned long now, unsigned long max) {
+    unsigned long next = max;
+    for (int i = 0; i < taskCount; i++) {
+        if (tasks[i]->due(now)) return 0;
+        unsigned long left = tasks[i]->wakeTime - now;
+        if (left < next) next = left;
+    }
+    return next;
+}
+
+// Lowest priority work: when no DeadlineTask is due and nothing holds the CPU
+// awake, sleeps in the core's delay(), which lets the WiFi stack run and the
+// SDK enter modem or light sleep. Tasks with their own stack are not known
+// here, maxIdle bounds the extra latency they may see.
+class IdleTask : public LeanTask {
+   public:
+    unsigned long maxIdle = 20;             // ms
+    unsigned long measureInterval = 5000;   // ms
+    uint8_t idlePercent = 0;                // share of time spent sleeping in the last interval
+
+   protected:
+    unsigned long idleTime = 0;
+    unsigned long measureStart = 0;
+
+    void loop() {
+        unsigned long now = millis();
+        if (measureInterval <= now - measureStart) {
+            idlePercent = idleTime * 100 / (now - measureStart);
+            idleTime = 0;
+            measureStart = now;
+        }
+        if (0 < tickless.awake) return;
+        unsigned long next = tickless.nextWakeup(now, maxIdle);
+        if (0 == next) return;
+        ::delay(next);
+        idleTime += millis() - now;
+    }
+} idleTask;
+
+#endif
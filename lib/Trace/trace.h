@@ -0,0 +1,243 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include <tickless.h>
+
+// Timeline tracing: begin, end and instant events into a fixed ring buffer,
+// exported as Chrome trace event JSON, which chrome://tracing and
+// ui.perfetto.dev open:
+//     {"traceEvents":[{"name":"MDNS.update","ph":"B","ts":1234,"pid":1,"tid":1},...]}
+// Compiled in with -DTRACE only, see the trace environments in
+// platformio.ini and test_trace in test/Makefile; otherwise the TRACE_
+// macros expand to nothing. Scopes export as begin and end events, the
+// difference of their ts is the duration.
+// Names must outlive the buffer: string literals or device names.
+//
+// Each track shows as one row. Events on a track have to nest, so code that
+// can be suspended mid-event by code on the same track, e.g. a Task with its
+// own stack that yields, gets a track of its own.
+#define TRACE_TRACK_LOOP 1     // DeadlineTasks, one after the other on the loop stack
+#define TRACE_TRACK_HTTP 2     // request handlers on the server, requests on the client
+#define TRACE_TRACK_STEPPER 3  // pulses
+#define TRACE_TRACK_TASK 4     // a Task with its own stack, e.g. the client's Config
+#define TRACE_TRACK_ISR 5      // interrupt handlers
+#define TRACE_MAX_TRACKS 6
+
+#ifndef TRACE_SIZE
+#define TRACE_SIZE 512  // events, 12 bytes each
+#endif
+
+struct TraceEvent {
+    uint32_t time;  // micros()
+    const char *name;
+    uint8_t track;
+    char phase;  // 'B'egin, 'E'nd, 'i'nstant
+};
+
+class Trace {
+   public:
+    bool recording = true;
+    bool pulses = false;  // also trace every stepper pulse, fills the buffer within a fraction of a second
+    uint32_t total = 0;   // events since the last clear(), the last TRACE_SIZE are kept
+    const char *trackNames[TRACE_MAX_TRACKS] = {"", "loop", "http", "stepper", "task", "isr"};
+
+    inline void IRAM_ATTR add(uint8_t track, char phase, const char *name) {
+        if (!recording) return;
+        uint32_t ps = xt_rsil(15);  // ISRs trace too
+        TraceEvent &e = events[total % TRACE_SIZE];
+        e.time = micros();
+        e.name = name;
+        e.track = track;
+        e.phase = phase;
+        total++;
+        xt_wsr_ps(ps);
+    }
+
+    bool exporting = false;
+
+    void clear() {
+        total = 0;
+    }
+
+    // Stops recording until endExport(), so the events read stay put
+    void beginExport() {
+        recording = false;
+        exporting = true;
+        exportState = EXPORT_HEADER;
+        lineLen = 0;
+        linePos = 0;
+    }
+
+    // Starts a new recording
+    void endExport() {
+        exporting = false;
+        clear();
+        recording = true;
+    }
+
+    // Fills [buf] with the next part of the JSON export, returns the length,
+    // 0 once it is complete. Call beginExport() first.
+    size_t read(uint8_t *buf, size_t size) {
+        size_t len = 0;
+        while (len < size) {
+            if (linePos == lineLen && !nextLine()) break;
+            size_t n = lineLen - linePos < size - len ? lineLen - linePos : size - len;
+            memcpy(buf + len, line + linePos, n);
+            linePos += n;
+            len += n;
+        }
+        return len;
+    }
+
+    // Writes the whole export, e.g. to Serial, and starts a new recording
+    void writeTo(Print &out) {
+        uint8_t buf[128];
+        size_t len;
+        beginExport();
+        while (0 < (len = read(buf, sizeof(buf)))) {
+            out.write(buf, len);
+            yield();
+        }
+        endExport();
+    }
+
+   protected:
+    enum { EXPORT_HEADER,
+           EXPORT_TRACKS,
+           EXPORT_EVENTS,
+           EXPORT_FOOTER,
+           EXPORT_DONE };
+
+    TraceEvent events[TRACE_SIZE];
+    int exportState = EXPORT_HEADER;
+    uint32_t exportIndex = 0;
+    uint32_t exportStart = 0;  // us, time of the first event exported, ts counts from it
+    char line[96];
+    size_t lineLen = 0;
+    size_t linePos = 0;
+
+    // Formats the next piece of the export into line, false when done
+    bool nextLine() {
+        uint32_t first = total < TRACE_SIZE ? 0 : total - TRACE_SIZE;
+        int len = 0;
+        switch (exportState) {
+            case EXPORT_HEADER:
+                len = snprintf(line, sizeof(line), "{\"traceEvents\":[\n");
+                exportState = EXPORT_TRACKS;
+                exportIndex = 1;
+                break;
+            case EXPORT_TRACKS:
+                len = snprintf(line, sizeof(line),
+                               "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                               1 == exportIndex ? "" : ",\n", exportIndex, trackNames[exportIndex]);
+                if (TRACE_MAX_TRACKS <= ++exportIndex) {
+                    exportState = EXPORT_EVENTS;
+                    exportIndex = first;
+                    exportStart = first < total ? events[first % TRACE_SIZE].time : 0;
+                }
+                break;
+            case EXPORT_EVENTS:
+                if (total <= exportIndex) {
+                    exportState = EXPORT_FOOTER;
+                    return nextLine();
+                } else {
+                    const TraceEvent &e = events[exportIndex++ % TRACE_SIZE];
+                    len = snprintf(line, sizeof(line),
+                                   ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":1,\"tid\":%u%s}",
+                                   e.name, e.phase, e.time - exportStart, e.track,
+                                   'i' == e.phase ? ",\"s\":\"t\"" : "");
+                }
+                break;
+            case EXPORT_FOOTER:
+                len = snprintf(line, sizeof(line), "],\n\"displayTimeUnit\":\"ms\"}\n");
+                exportState = EXPORT_DONE;
+                break;
+            default:
+                return false;
+        }
+        lineLen = len < (int)sizeof(line) ? len : sizeof(line) - 1;
+        linePos = 0;
+        return true;
+    }
+};
+
+#ifdef TRACE
+Trace trace;
+
+// Ends the event when it goes out of scope
+class TraceScope {
+   public:
+    TraceScope(uint8_t track, const char *name) {
+        this->track = track;
+        this->name = name;
+        trace.add(track, 'B', name);
+    }
+
+    ~TraceScope() {
+        trace.add(track, 'E', name);
+    }
+
+   protected:
+    uint8_t track;
+    const char *name;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_BEGIN(track, name) trace.add(track, 'B', name)
+#define TRACE_END(track, name) trace.add(track, 'E', name)
+#define TRACE_INSTANT(track, name) trace.add(track, 'i', name)
+#define TRACE_SCOPE(track, name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(track, name)
+#define TRACE_PULSE()                                                     \
+    do {                                                                  \
+        if (trace.pulses) trace.add(TRACE_TRACK_STEPPER, 'i', "pulse"); \
+    } while (0)
+
+// Prints the trace to the serial console every [interval] ms and starts a
+// new one, for firmwares without an HTTP server. A full buffer is tens of
+// kB, seconds at 115200 baud, so each pass only writes what fits into the
+// UART FIFO and the other tasks keep running in between. Nothing is
+// recorded while printing, log messages may end up within the dump.
+class TraceDumpTask : public DeadlineTask {
+   public:
+    unsigned long interval = 10000;  // ms between dumps
+    int drainDelay = 10;             // ms between passes while dumping
+
+   protected:
+    bool dumping = false;
+
+    void setup() {
+        sleep(interval);
+    }
+
+    void loop() {
+        if (!dumping) {
+            Serial.println("[Trace] Chrome trace events:");
+            trace.beginExport();
+            dumping = true;
+        }
+        uint8_t buf[128];
+        int room;
+        while (0 < (room = Serial.availableForWrite())) {
+            size_t len = trace.read(buf, (size_t)room < sizeof(buf) ? room : sizeof(buf));
+            if (0 == len) {
+                trace.endExport();
+                dumping = false;
+                sleep(interval);
+                return;
+            }
+            Serial.write(buf, len);
+        }
+        sleep(drainDelay);
+    }
+};
+#else
+#define TRACE_BEGIN(track, name)
+#define TRACE_END(track, name)
+#define TRACE_INSTANT(track, name)
+#define TRACE_SCOPE(track, name)
+#define TRACE_PULSE()
+#endif
+
+#endif
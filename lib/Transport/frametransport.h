@@ -0,0 +1,92 @@
+#ifndef FRAMETRANSPORT_H
+#define FRAMETRANSPORT_H
+
+#include <Arduino.h>
+
+// The radio-independent part of the transports, builds on the host as well
+// as on the ESP, see transport.h for the radios.
+
+#define TRANSPORT_FRAME_SIZE 96  // fits the largest frame, a GroupBeacon
+#define TRANSPORT_QUEUE_SIZE 8   // frames received but not yet read
+
+// Carries small frames, group commands and beacons, to every node in reach.
+// Sending and reading are non-blocking, a frame that does not fit is dropped.
+// Commands to a single device stay on HTTP, /api/control, which answers
+// with a status the sender acts on; frames are fire-and-forget.
+class Transport {
+   public:
+    const char *name = "";
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    uint32_t dropped = 0;
+
+    virtual bool send(const uint8_t *frame, size_t size) = 0;
+
+    // Copies the next received frame into [frame], returns its size, 0 if there is none
+    virtual size_t receive(uint8_t *frame, size_t size) = 0;
+};
+
+// Frames pushed from a callback and read by a task, single producer and
+// single consumer
+class FrameQueue {
+   public:
+    bool push(const uint8_t *frame, size_t size) {
+        uint8_t next = (head + 1) % TRANSPORT_QUEUE_SIZE;
+        if (next == tail || TRANSPORT_FRAME_SIZE < size) return false;
+        memcpy(frames[head], frame, size);
+        sizes[head] = size;
+        head = next;
+        return true;
+    }
+
+    size_t pop(uint8_t *frame, size_t size) {
+        if (tail == head) return 0;
+        size_t frameSize = sizes[tail] < size ? sizes[tail] : size;
+        memcpy(frame, frames[tail], frameSize);
+        tail = (tail + 1) % TRANSPORT_QUEUE_SIZE;
+        return frameSize;
+    }
+
+   private:
+    uint8_t frames[TRANSPORT_QUEUE_SIZE][TRANSPORT_FRAME_SIZE];
+    uint8_t sizes[TRANSPORT_QUEUE_SIZE];
+    volatile uint8_t head = 0;
+    volatile uint8_t tail = 0;
+};
+
+// Two ends joined in memory: what one sends the other receives. Connects a
+// sender and a receiver without a radio, e.g. to run the group command path
+// within one firmware or on the host.
+class LoopbackTransport : public Transport {
+   public:
+    LoopbackTransport *peer = nullptr;
+
+    LoopbackTransport() {
+        name = "loopback";
+    }
+
+    void connect(LoopbackTransport *peer) {
+        this->peer = peer;
+        peer->peer = this;
+    }
+
+    bool send(const uint8_t *frame, size_t size) {
+        if (nullptr == peer) return false;
+        if (!peer->queue.push(frame, size)) {
+            peer->dropped++;
+            return false;
+        }
+        peer->received++;
+        sent++;
+        return true;
+    }
+
+    size_t receive(uint8_t *frame, size_t size) {
+        return queue.pop(frame, size);
+    }
+
+   protected:
+    FrameQueue queue;
+};
+
+#endif
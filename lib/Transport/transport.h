@@ -0,0 +1,128 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <espnow.h>
+
+#include <groupcommand.h>
+#include <frametransport.h>
+
+// UDP multicast on the WiFi network, joined once there is an address
+class UdpTransport : public Transport {
+   public:
+    UdpTransport() {
+        name = "udp";
+    }
+
+    bool send(const uint8_t *frame, size_t size) {
+        if (!begin()) return false;
+        if (!udp.beginPacketMulticast(GROUP_ADDRESS, GROUP_PORT, localIP())) return false;
+        udp.write(frame, size);
+        if (!udp.endPacket()) return false;
+        sent++;
+        return true;
+    }
+
+    size_t receive(uint8_t *frame, size_t size) {
+        if (!begin()) return 0;
+        while (0 < udp.parsePacket()) {
+            int read = udp.read(frame, size);
+            if (0 < read) {
+                received++;
+                return read;
+            }
+            dropped++;
+        }
+        return 0;
+    }
+
+   protected:
+    WiFiUDP udp;
+    bool joined = false;
+
+    IPAddress localIP() {
+        return WiFi.getMode() == WIFI_AP ? WiFi.softAPIP() : WiFi.localIP();
+    }
+
+    bool begin() {
+        if (joined) return true;
+        if (WiFi.getMode() != WIFI_AP && WL_CONNECTED != WiFi.status()) return false;
+        joined = udp.beginMulticast(localIP(), GROUP_ADDRESS, GROUP_PORT);
+        return joined;
+    }
+};
+
+// ESP-NOW broadcast: vendor action frames straight to every node on the
+// channel, no IP, no TCP. The radio stays on the channel of the WiFi link,
+// so both ends still have to be on the same network, or the remote
+// associated with the server's access point: this skips the IP stack, not
+// association, and frames stop while the remote reconnects.
+class EspNowTransport : public Transport {
+   public:
+    uint32_t sendLatency = 0;  // us, moving average from esp_now_send() to the SDK's sent callback, no reply
+
+    EspNowTransport() {
+        name = "espnow";
+    }
+
+    bool send(const uint8_t *frame, size_t size) {
+        if (!begin()) return false;
+        sendStart = micros();
+        if (0 != esp_now_send(broadcast, (uint8_t *)frame, size)) return false;
+        sent++;
+        return true;
+    }
+
+    size_t receive(uint8_t *frame, size_t size) {
+        if (!begin()) return 0;
+        return queue.pop(frame, size);
+    }
+
+   protected:
+    uint8_t broadcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    FrameQueue queue;
+    bool started = false;
+    volatile uint32_t sendStart = 0;
+
+    bool begin() {
+        if (started) return true;
+        if (WIFI_OFF == WiFi.getMode()) return false;
+        if (0 != esp_now_init()) return false;
+        instance() = this;
+        esp_now_set_self_role(ESP_NOW_ROLE_COMBO);
+        esp_now_add_peer(broadcast, ESP_NOW_ROLE_COMBO, 0, nullptr, 0);  // channel 0: the current one
+        esp_now_register_recv_cb(onReceive);
+        esp_now_register_send_cb(onSent);
+        started = true;
+        return true;
+    }
+
+    static EspNowTransport *&instance() {
+        static EspNowTransport *transport = nullptr;
+        return transport;
+    }
+
+    // called from the SDK, keep short
+    static void onReceive(uint8_t *mac, uint8_t *data, uint8_t len) {
+        EspNowTransport *transport = instance();
+        if (nullptr == transport) return;
+        if (transport->queue.push(data, len))
+            transport->received++;
+        else
+            transport->dropped++;
+    }
+
+    static void onSent(uint8_t *mac, uint8_t status) {
+        EspNowTransport *transport = instance();
+        if (nullptr == transport) return;
+        uint32_t latency = micros() - transport->sendStart;
+        transport->sendLatency = transport->sendLatency - transport->sendLatency / 8 + latency / 8;
+    }
+};
+
+UdpTransport udpTransport;
+EspNowTransport espNowTransport;
+
+#endif
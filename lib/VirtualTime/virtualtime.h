@@ -0,0 +1,37 @@
+#ifndef VIRTUALTIME_H
+#define VIRTUALTIME_H
+
+#include <Arduino.h>
+
+// Rollover testing on the device. With VIRTUAL_TIME defined and the
+// firmware linked with -Wl,--wrap=millis,--wrap=micros (see the rollover
+// env in platformio.ini), millis() and micros() start just before they wrap
+// around, so code that compares absolute times instead of elapsed ones
+// fails minutes after boot instead of after 49 days. Time still runs at
+// the real rate. Fast, reproducible runs of the server's tasks over days of
+// virtual time are in test/host/simulation.h; on the host unsigned long is
+// 64 bits, so millis() never wraps there and this env covers that.
+#ifdef VIRTUAL_TIME
+
+#ifndef VIRTUAL_TIME_MILLIS_OFFSET
+#define VIRTUAL_TIME_MILLIS_OFFSET (UINT32_MAX - 300000UL)  // millis() wraps 5 min after boot
+#endif
+#ifndef VIRTUAL_TIME_MICROS_OFFSET
+#define VIRTUAL_TIME_MICROS_OFFSET (UINT32_MAX - 60000000UL)  // micros() wraps 1 min after boot
+#endif
+
+extern "C" {
+unsigned long __real_millis();
+unsigned long __real_micros();
+
+unsigned long __wrap_millis() {
+    return __real_millis() + VIRTUAL_TIME_MILLIS_OFFSET;
+}
+
+unsigned long __wrap_micros() {
+    return __real_micros() + VIRTUAL_TIME_MICROS_OFFSET;
+}
+}
+
+#endif
+#endif
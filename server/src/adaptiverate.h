@@ -0,0 +1,75 @@
+#ifndef ADAPTIVERATE_H
+#define ADAPTIVERATE_H
+
+#include <Arduino.h>
+
+#include <heapmonitor.h>
+#include <log.h>
+#include <tickless.h>
+#include <trace.h>
+
+#include "admission.h"
+#include "config.h"
+
+// Derives the command interval clients are asked to keep (config.rate)
+// from the server's own load. While the control handler is slow, steps are
+// late, the heap is low or requests are being shed, the interval doubles,
+// otherwise it shrinks by a tenth per update.
+class AdaptiveRate : public DeadlineTask {
+   public:
+    Config *config = nullptr;
+    int rateMin = 50;                // ms, fastest interval advertised
+    int rateMax = 2000;              // ms, slowest interval advertised
+    uint32_t latencyMax = 5000;      // us, control handler average that counts as busy
+    uint32_t stallMax = 2000;        // us, step lateness that counts as busy
+    uint32_t heapMin = 16384;        // bytes, free heap that counts as low
+    unsigned long interval = 1000;   // ms between updates
+    uint32_t latency = 0;            // us, moving average of the control handler
+    uint32_t stall = 0;              // us, worst step lateness of the last interval
+
+    void setConfig(Config *config) {
+        this->config = config;
+    }
+
+    void recordLatency(uint32_t us) {
+        latency = latency - latency / 8 + us / 8;
+    }
+
+    void update() {
+        if (nullptr == config) return;
+        stall = 0;
+        for (int i = 0; i < config->deviceCount; i++) {
+            uint32_t s = config->devices[i]->takeStall();
+            if (stall < s) stall = s;
+        }
+        uint32_t freeHeap = ESP.getFreeHeap();
+        bool busy = latencyMax < latency ||
+                    stallMax < stall ||
+                    freeHeap < heapMin ||
+                    lastShed != admission.shed;
+        lastShed = admission.shed;
+        int rate = config->rate;
+        if (busy)
+            rate = rateMax / 2 < rate ? rateMax : rate * 2;
+        else
+            rate -= rate / 10 < 1 ? 1 : rate / 10;
+        if (rate < rateMin) rate = rateMin;
+        if (rate == config->rate) return;
+        LOG_D("[Rate] %d ms (latency: %u us  stall: %u us  heap: %u)\n",
+              rate, latency, stall, freeHeap);
+        config->rate = rate;
+        admission.setRate(rate, config->deviceCount);
+    }
+
+   protected:
+    void loop() {
+        TRACE_SCOPE(TRACE_TRACK_LOOP, "adaptiveRate");
+        update();
+        sleep(interval);
+    }
+
+   private:
+    uint32_t lastShed = 0;
+} adaptiveRate;
+
+#endif
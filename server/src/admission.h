@@ -0,0 +1,116 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <log.h>
+
+#define ADMISSION_MAX_CLIENTS 8
+
+// Token bucket of one remote address, tokens are kept in thousandths
+struct ClientBucket {
+    uint32_t ip;
+    uint32_t tokens;
+    unsigned long lastRefill;  // ms
+};
+
+// Sheds requests before they can exhaust the heap or flood the devices.
+// Every request counts against maxConcurrent until its client disconnects,
+// and is refused with 503 above that or below minFreeHeap. AsyncWebServer
+// serves one request per connection, so the disconnect ends the response.
+// Rate limited requests additionally take a token from the bucket of their
+// remote address, and are refused with 429 if it is empty. Both refusals
+// carry Retry-After.
+class Admission {
+   public:
+    int maxConcurrent = 4;             // requests in flight
+    uint32_t minFreeHeap = 8192;       // bytes
+    uint32_t tokensPerSecond = 10;     // refill rate of each bucket
+    uint32_t burst = 4;                // bucket size
+    volatile int concurrent = 0;
+    uint32_t accepted = 0;
+    uint32_t rateLimited = 0;          // replied 429
+    uint32_t shed = 0;                 // replied 503
+
+    // Allows [commandsPerRate] commands per [rate] milliseconds, twice that
+    // in bursts to absorb jitter.
+    void setRate(int rate, int commandsPerRate) {
+        if (rate < 1) rate = 1;
+        if (commandsPerRate < 1) commandsPerRate = 1;
+        tokensPerSecond = (1000 * commandsPerRate + rate - 1) / rate;
+        burst = 2 * commandsPerRate;
+    }
+
+    // Returns true if the request may proceed, otherwise it has been
+    // answered already.
+    bool admit(AsyncWebServerRequest *request, bool limitRate = false) {
+        if (maxConcurrent <= concurrent || ESP.getFreeHeap() < minFreeHeap) {
+            shed++;
+            LOG_D("[Admission] shedding request, concurrent: %d\n", concurrent);
+            refuse(request, 503);
+            return false;
+        }
+        if (limitRate && !take(remoteIP(request))) {
+            rateLimited++;
+            refuse(request, 429);
+            return false;
+        }
+        accepted++;
+        concurrent = concurrent + 1;
+        request->onDisconnect([this]() { concurrent = concurrent - 1; });
+        return true;
+    }
+
+   protected:
+    ClientBucket clients[ADMISSION_MAX_CLIENTS];
+    int clientCount = 0;
+
+    // Clients back off for Retry-After instead of counting the refusal as a failure
+    void refuse(AsyncWebServerRequest *request, int code) {
+        AsyncWebServerResponse *response = request->beginResponse(code);
+        response->addHeader("Retry-After", "1");
+        response->addHeader("Access-Control-Allow-Origin", "*");
+        request->send(response);
+    }
+
+    uint32_t remoteIP(AsyncWebServerRequest *request) {
+        AsyncClient *client = request->client();
+        if (nullptr == client) return 0;
+        return (uint32_t)client->remoteIP();
+    }
+
+    // Takes a token from the bucket of the address, a new address starts
+    // with a full bucket and replaces the one idle for the longest time.
+    bool take(uint32_t ip) {
+        unsigned long t = millis();
+        ClientBucket *bucket = nullptr;
+        for (int i = 0; i < clientCount; i++) {
+            if (clients[i].ip == ip) {
+                bucket = &clients[i];
+                break;
+            }
+        }
+        if (nullptr == bucket) {
+            if (clientCount < ADMISSION_MAX_CLIENTS)
+                bucket = &clients[clientCount++];
+            else {
+                bucket = &clients[0];
+                for (int i = 1; i < clientCount; i++)
+                    if (t - bucket->lastRefill < t - clients[i].lastRefill)
+                        bucket = &clients[i];
+            }
+            bucket->ip = ip;
+            bucket->tokens = burst * 1000;
+            bucket->lastRefill = t;
+        }
+        uint32_t elapsed = t - bucket->lastRefill;
+        bucket->lastRefill = t;
+        uint32_t refill = elapsed < 60000 ? elapsed * tokensPerSecond : burst * 1000;
+        bucket->tokens = bucket->tokens + refill < burst * 1000 ? bucket->tokens + refill : burst * 1000;
+        if (bucket->tokens < 1000) return false;
+        bucket->tokens -= 1000;
+        return true;
+    }
+} admission;
+
+#endif
@@ -1,25 +1,29 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-#include <Arduino_JSON.h>
 #include <Scheduler.h>  // https://github.com/nrwiersma/ESP8266Scheduler
 #include <ESPAsyncWebServer.h>
 #include "devices.h"
+#include "jsonwriter.h"
+#include "recorder.h"
 
 #define MAX_DEVICES 32
 #define JSON_MODE_PRIVATE 0
 #define JSON_MODE_PUBLIC 1
+#define MDNS_TXT_VERSION 1  // bump when the TXT device summary format changes
 
 class Config {
    public:
     const char *name;
-    int rate;
+    int rate;  // ms between commands a client should keep, adapted to load at runtime
     const char *mdnsService;
     const char *mdnsProtocol;
     int apiPort;
+    unsigned long leaseTime = 5000;  // ms a controller keeps a device after its last command
     Device *devices[MAX_DEVICES];
     int deviceCount = 0;
     AsyncWebServer *server;  // TODO not used
+    CommandRecorder *recorder = nullptr;  // keeps every control command applied, see recorder.h
 
     Config(
         const char *name = "Controller",
@@ -43,7 +47,7 @@ class Config {
 
     bool addDevice(Device *device) {
         if (hasDevice(device->name)) {
-            Serial.printf("[Config] Device name \"%s\" already exists.", device->name);
+            LOG_E("[Config] Device name \"%s\" already exists.\n", device->name);
             return false;
         }
         device->server = server;
@@ -62,8 +66,8 @@ class Config {
     }
 
     Device *device(int i) {
-        if (i > deviceCount) {
-            Serial.printf("[Config] Device %i not found.\n", i);
+        if (i < 0 || deviceCount <= i) {
+            LOG_W("[Config] Device %i not found.\n", i);
             return nullptr;
         }
         return devices[i];
@@ -76,53 +80,105 @@ class Config {
                 return devices[i];
             }
         }
-        Serial.printf("[Config] Device \"%s\" not found.\n", name);
+        LOG_W("[Config] Device not found\n");  // the name is the request's, gone before the log drains
         return nullptr;
     }
 
+    // Any command or frame from [owner] keeps the links of all its leases up,
+    // not only of the device it addresses
+    void hear(uint32_t owner) {
+        for (int i = 0; i < deviceCount; i++)
+            devices[i]->lease.hear(owner);
+    }
+
+    int indexOf(Device *device) {
+        for (int i = 0; i < deviceCount; i++)
+            if (device == devices[i]) return i;
+        return -1;
+    }
+
+    // Applies control arguments, from a request or a replay, to the device
+    // they address and returns the HTTP status. The message is filled on
+    // errors and, if args.verbose is set, on success.
+    int control(ControlArgs &args, char *message, size_t size) {
+        // the device is addressed by index or by name
+        const char *deviceName = args.get("device");
+        int index;
+        Device *device = nullptr;
+        if (args.getInt("device", &index))
+            device = this->device(index);
+        else if (nullptr != deviceName)
+            device = this->device(deviceName);
+        if (nullptr == device) {
+            LOG_D("[Config] Control request received for a non-existent device\n");
+            snprintf(message, size, "Device does not exist");
+            return 500;
+        }
+        int priority = 0;
+        args.getInt("priority", &priority);
+        uint32_t owner = args.owner();
+        hear(owner);
+        int code;
+        if (device->lease.available(owner, priority)) {
+            code = device->control(args, message, size);
+            // a request the device refused does not take the lease
+            if (200 <= code && code < 300) device->lease.acquire(owner, priority, leaseTime);
+        } else {
+            snprintf(message, size, "[%s] leased by another controller", device->name);
+            code = 409;
+        }
+        if (nullptr != recorder) recorder->record(indexOf(device), owner, args, code);
+        return code;
+    }
+
     void handleApiControl(AsyncWebServerRequest *request) {
         // Serial.println("[Config] handleApiControl()");
         if (nullptr == request) {
-            Serial.println("[Config] handleApiControl: error: request is null");
+            LOG_E("[Config] handleApiControl: error: request is null\n");
             return;
         }
-        const char *deviceName = request->arg("device").c_str();
-        // Serial.printf("[Config] Received control request for %s\n", deviceName);
-        Device *device = this->device(deviceName);
-        if (nullptr == device) {
-            Serial.printf("[Config] Control request received for non-existent device \"%s\"\n", deviceName);
-            request->send(500, "text/plain", "Device does not exist");
-            return;
-        }
-        device->handleApiControl(request);
+        ControlArgs args(request);
+        char message[100] = "";
+        int code = control(args, message, sizeof(message));
+        if (200 == code && !args.verbose)
+            code = 204;  // nothing to say, no body to build
+        AsyncWebServerResponse *response = 204 == code
+                                               ? request->beginResponse(code)
+                                               : request->beginResponse(code, "text/plain", message);
+        char rateValue[12];
+        snprintf(rateValue, sizeof(rateValue), "%d", rate);
+        response->addHeader("X-Rate", rateValue);  // current interval, it follows the server's load
+        response->addHeader("Access-Control-Expose-Headers", "X-Rate");
+        response->addHeader("Access-Control-Allow-Origin", "*");
+        request->send(response);
     }
 
     void startControlTasks() {
         for (int i = 0; i < deviceCount; i++) {
-            Serial.printf("[Config] Starting control task for device %i\n", i);
-            Scheduler.start(devices[i]);
+            AbstractTask *task = devices[i]->task();
+            if (nullptr == task) continue;
+            LOG_I("[Config] Starting control task for device %i\n", i);
+            Scheduler.start(task);
         }
     }
 
-    JSONVar toJSONVar(int mode = JSON_MODE_PRIVATE) {
-        JSONVar j;
-        j["name"] = name;
-        j["rate"] = rate;
+    void writeJson(JsonWriter &json, int mode = JSON_MODE_PRIVATE) {
+        json.beginObject();
+        json.value("name", name);
+        json.value("rate", rate);
+        json.value("lease", leaseTime);
         if (JSON_MODE_PRIVATE == mode) {
-            j["mdnsService"] = mdnsService;
-            j["apiPort"] = apiPort;
+            json.value("mdnsService", mdnsService);
+            json.value("apiPort", apiPort);
         }
-        JSONVar devices;
+        json.beginArray("devices");
         for (int i = 0; i < deviceCount; i++) {
-            JSONVar device = this->devices[i]->toJSONVar(mode);
-            devices[i] = device;
+            json.beginObject();
+            devices[i]->writeJson(json, mode);
+            json.endObject();
         }
-        j["devices"] = devices;
-        return j;
-    }
-
-    String toJsonString(int mode = JSON_MODE_PRIVATE) {
-        return JSON.stringify(toJSONVar(mode));
+        json.endArray();
+        json.endObject();
     }
 };
 
@@ -1,38 +1,240 @@
 #ifndef DEVICES_H
 #define DEVICES_H
 
-#include <Arduino_JSON.h>
 #include <ESPAsyncWebServer.h>
 
 #include <Scheduler.h>  // https://github.com/nrwiersma/ESP8266Scheduler
 #include <Task.h>
 #include <LeanTask.h>
+#include <i2s.h>
+
+#include <histogram.h>
+#include <log.h>
+#include <pincapture.h>
+#include <tickless.h>
+#include <trace.h>
+#ifdef BENCHMARK
+#include <bench.h>
+#endif
+
+#include "jsonwriter.h"
+#include "waveform.h"
 
 #define JSON_MODE_PRIVATE 0
 #define JSON_MODE_PUBLIC 1
 
-class Device : public Task {
+// Lease owner id of a controller from its client id, FNV-1a
+uint32_t ownerOf(const char *client) {
+    uint32_t hash = 2166136261u;
+    for (const char *c = client; '\0' != *c; c++)
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    return 0 == hash ? 1 : hash;
+}
+
+// Arguments of a control request. Values point into the request's own
+// parameter list, looking them up does not allocate.
+class ControlArgs {
+   public:
+    bool verbose = false;  // reply with a message even on success
+
+    ControlArgs(AsyncWebServerRequest *request) {
+        this->request = request;
+        verbose = nullptr != get("verbose");
+    }
+
+    // Arguments that come without a request, e.g. from a replay: [pairs]
+    // holds [count] names, each followed by its value, and [owner] stands
+    // for the controller that sent them
+    ControlArgs(const char *const *pairs, int count, uint32_t owner) {
+        this->pairs = pairs;
+        pairCount = count;
+        pairsOwner = owner;
+    }
+
+    // Value of the parameter, nullptr if it is missing
+    const char *get(const char *name) {
+        if (nullptr == request) {
+            for (int i = 0; i < pairCount; i++)
+                if (0 == strcmp(name, pairs[2 * i])) return pairs[2 * i + 1];
+            return nullptr;
+        }
+        size_t count = request->params();
+        for (size_t i = 0; i < count; i++) {
+            AsyncWebParameter *param = request->getParam(i);
+            if (param->name() == name) return param->value().c_str();
+        }
+        return nullptr;
+    }
+
+    // Identifies the controller: a hash of the "client" parameter, or the
+    // remote address for controllers that do not send one (the web UI)
+    uint32_t owner() {
+        if (nullptr == request) return pairsOwner;
+        const char *client = get("client");
+        if (nullptr != client && '\0' != *client) return ownerOf(client);
+        uint32_t ip = nullptr == request->client() ? 0 : (uint32_t)request->client()->remoteIP();
+        return 0 == ip ? 1 : ip;
+    }
+
+    // Parses an unsigned decimal parameter, false if missing or malformed
+    bool getUnsigned(const char *name, uint32_t *value) {
+        const char *s = get(name);
+        if (nullptr == s || !isdigit(*s)) return false;
+        char *end;
+        unsigned long parsed = strtoul(s, &end, 10);
+        if ('\0' != *end) return false;
+        *value = parsed;
+        return true;
+    }
+
+    // Parses a decimal integer parameter, false if missing or malformed
+    bool getInt(const char *name, int *value) {
+        const char *s = get(name);
+        if (nullptr == s || '\0' == *s) return false;
+        char *end;
+        long parsed = strtol(s, &end, 10);
+        if ('\0' != *end) return false;
+        *value = parsed;
+        return true;
+    }
+
+   protected:
+    AsyncWebServerRequest *request = nullptr;
+    const char *const *pairs = nullptr;
+    int pairCount = 0;
+    uint32_t pairsOwner = 0;
+};
+
+// Ownership of a device by one controller. While the lease runs, commands
+// from others are refused unless they come with a higher priority. Every
+// accepted command renews the lease. An owner that sends heartbeats is
+// also watched for link loss: once it has been silent for its linkTimeout,
+// lost() is true and the device should be stopped.
+class Lease {
+   public:
+    uint32_t owner = 0;  // 0: never leased
+    int priority = 0;
+    unsigned long expires = 0;      // ms
+    unsigned long heard = 0;        // ms, last command or heartbeat from the owner
+    unsigned long linkTimeout = 0;  // ms, 0: the owner sends no heartbeats, not watched
+
+    bool held(unsigned long t) {
+        return 0 != owner && 0 < (long)(expires - t);
+    }
+
+    // Whether acquire() would succeed
+    bool available(uint32_t owner, int priority) {
+        return !held(millis()) || owner == this->owner || this->priority < priority;
+    }
+
+    // Takes or renews the lease, returns false if another owner holds it
+    bool acquire(uint32_t owner, int priority, unsigned long duration) {
+        unsigned long t = millis();
+        if (!available(owner, priority)) return false;
+        if (owner != this->owner) {
+            LOG_D("[Lease] %08x takes over from %08x\n", owner, this->owner);
+            linkTimeout = 0;  // until the new owner's first heartbeat
+        }
+        this->owner = owner;
+        this->priority = priority;
+        expires = t + duration;
+        heard = t;
+        return true;
+    }
+
+    // A heartbeat from [owner] renews its lease and keeps the link watched
+    bool heartbeat(uint32_t owner, unsigned long timeout, unsigned long duration) {
+        unsigned long t = millis();
+        if (owner != this->owner || !held(t)) return false;
+        expires = t + duration;
+        heard = t;
+        linkTimeout = timeout;
+        return true;
+    }
+
+    // Traffic from [owner] of any kind shows its link is up
+    void hear(uint32_t owner) {
+        unsigned long t = millis();
+        if (owner == this->owner && held(t)) heard = t;
+    }
+
+    // The watched owner has been silent for too long
+    bool lost(unsigned long t) {
+        return 0 < linkTimeout && linkTimeout < t - heard;
+    }
+
+    // Ends the lease after a link loss, so any controller can take over
+    void release() {
+        linkTimeout = 0;
+        expires = millis();
+    }
+};
+
+// Devices that need their own stack (blocking loops, delay()) also derive
+// from Task, the others from DeadlineTask, which runs on the loop stack.
+class Device {
    public:
     const char *name = "";
     const char *type = "";
     bool enabled = false;
     AsyncWebServer *server;
+    Lease lease;
+    const char *group = "";  // multicast group the device follows, "" for none
 
-    virtual void handleApiControl(AsyncWebServerRequest *request, AsyncWebServerResponse *response = nullptr) {
-        // Serial.printf("[Device %s] handleApiControl()\n", name);
-        if (nullptr != response)
-            response->addHeader("Access-Control-Allow-Origin", "*");
+    // Applies a control request and returns the HTTP status. The message is
+    // filled on errors and, if args.verbose is set, on success.
+    virtual int control(ControlArgs &args, char *message, size_t size) {
+        snprintf(message, size, "[%s] not controllable", name);
+        return 400;
     };
 
-    virtual JSONVar toJSONVar(int mode = JSON_MODE_PRIVATE) {
-        JSONVar j;
-        j["name"] = name;
-        j["type"] = type;
-        return j;
+    // Applies a command that came without a request, e.g. from a group.
+    // Returns false if the device takes no commands.
+    virtual bool apply(int command, unsigned long slew = 0) {
+        return false;
+    }
+
+    // Brings the device to rest when its controller is gone, along the
+    // device's own ramp where it has one
+    virtual void stop() {
+    }
+
+    // Worst lateness of the device's timing in us since the last call
+    virtual uint32_t takeStall() {
+        return 0;
+    }
+
+    // Lateness of every step in us, nullptr if the device does not step
+    virtual Histogram *jitter() {
+        return nullptr;
+    }
+
+#ifdef PIN_CAPTURE
+    // Writes the step timing seen in the pin capture as an array element,
+    // nothing if the device does not step
+    virtual void writeStepMetrics(JsonWriter &json, uint32_t windowNs) {
+    }
+#endif
+
+    // The scheduler task running this device, nullptr if it needs none
+    virtual AbstractTask *task() {
+        return nullptr;
+    }
+
+    // Writes the members of the device's JSON object, the caller opens and closes it
+    virtual void writeJson(JsonWriter &json, int mode = JSON_MODE_PRIVATE) {
+        json.value("name", name);
+        json.value("type", type);
+        if ('\0' != *group) json.value("group", group);
+    }
+
+    // Compact summary for the mDNS TXT record: "name,type"
+    virtual int toTxt(char *buf, size_t size) {
+        return snprintf(buf, size, "%s,%s", name, type);
     }
 };
 
-class Stepper : public Device {
+class Stepper : public Device, public Task {
    public:
     int pinEnable;                      // enable pin
     int pinDirection;                   // direction pin
@@ -46,6 +248,11 @@ class Stepper : public Device {
     int command = 0;                    // command being executed
     int setPoint = 0;                   // command target
     unsigned long lastCommandTime = 0;  // time of last command received, can be used for a watchdog
+    int idleDelay = 5;                  // ms between checks for a new set point while stopped
+    unsigned long slewMax = 60000;      // ms, longest transition a command can ask for
+    unsigned long scheduleMax = 10000;  // ms, how far ahead a command can be scheduled
+    uint32_t directionSetup = 650;      // ns the driver needs between a direction change and a pulse (DRV8825: 650, A4988: 200)
+    unsigned long stopSlew = 0;         // ms over which stop() slows down, 0: the changeMax ramp alone
 
     Stepper(
         const char *name = "Stepper",
@@ -71,83 +278,215 @@ class Stepper : public Device {
         this->changeMax = changeMax;
     }
 
-    void handleApiControl(AsyncWebServerRequest *request, AsyncWebServerResponse *response = nullptr) {
-        // Serial.printf("[Stepper %s] handleApiControl()\n", name);
-        if (!request->hasArg("command")) {
-            request->send(400, "text/plain", "missing command");
+    AbstractTask *task() {
+        return this;
+    }
+
+    bool apply(int command, unsigned long slew = 0) {
+        if (command < commandMin)
+            command = commandMin;
+        else if (command > commandMax)
+            command = commandMax;
+        moveTo(command, slew < slewMax ? slew : slewMax);
+        lastCommandTime = millis();
+        return true;
+    }
+
+    // Moves the set point to [target] linearly over [duration] ms, at once if 0.
+    // Drops a scheduled command, the newer one wins.
+    void moveTo(int target, unsigned long duration = 0) {
+        pending = false;
+        slewing = false;
+        if (0 == duration) {
+            setPoint = target;
             return;
         }
-        int command = request->arg("command").toInt();
+        slewFrom = setPoint;
+        slewTarget = target;
+        slewStart = millis();
+        slewDuration = duration;
+        slewing = true;
+    }
+
+    // Decelerates to a stop and, through moveTo(), drops a scheduled command,
+    // so nothing sent before the stop starts the motor again
+    void stop() {
+        moveTo(0, stopSlew);
+    }
+
+    // Calls moveTo() once micros() reaches [at], a past [at] applies on the next step
+    void schedule(int target, unsigned long duration, uint32_t at) {
+        pending = false;
+        pendingTarget = target;
+        pendingDuration = duration;
+        pendingAt = at;
+        pending = true;
+    }
+
+    uint32_t takeStall() {
+        uint32_t s = stall;
+        stall = 0;
+        return s;
+    }
+
+    Histogram *jitter() {
+        return &lateness;
+    }
+
+#ifdef PIN_CAPTURE
+    void writeStepMetrics(JsonWriter &json, uint32_t windowNs) {
+        StepMetrics m = pinCapture.stepMetrics(pinPulse, pinDirection, pulseWidth * 1000, directionSetup, windowNs);
+        json.beginObject()
+            .value("name", name)
+            .value("steps", m.steps)
+            .value("pulseWidth", pulseWidth * 1000)
+            .value("pulseWidthMin", m.pulseWidthMin)
+            .value("pulseWidthMax", m.pulseWidthMax)
+            .value("widthViolations", m.widthViolations)
+            .value("directionChanges", m.directionChanges)
+            .value("directionSetup", directionSetup)
+            .value("setupMin", m.setupMin)
+            .value("setupViolations", m.setupViolations)
+            .value("window", windowNs);
+        json.beginArray("frequency");  // Hz in consecutive windows from arming
+        for (int i = 0; i < m.windowCount; i++)
+            json.value(nullptr, (uint32_t)((uint64_t)m.stepsPerWindow[i] * 1000000000 / windowNs));
+        json.endArray();
+        json.endObject();
+    }
+#endif
+
+    int control(ControlArgs &args, char *message, size_t size) {
+        int command;
+        if (!args.getInt("command", &command)) {
+            snprintf(message, size, "missing command");
+            return 400;
+        }
         if (command < commandMin)
             command = commandMin;
         else if (command > commandMax)
             command = commandMax;
-        this->setPoint = command;
+        int slew = 0;
+        args.getInt("slew", &slew);
+        slew = slew < 0 ? 0 : (unsigned long)slew < slewMax ? slew : slewMax;
+        uint32_t at;
+        if (args.getUnsigned("at", &at)) {
+            // at is on this server's micros() clock, which the client keeps in sync with
+            uint32_t ahead = at - micros();  // wraps with the clock, also where long is 64 bits
+            if (0 < (int32_t)ahead && scheduleMax * 1000 < ahead) {
+                snprintf(message, size, "[%s] command scheduled too far ahead", name);
+                return 400;
+            }
+            schedule(command, slew, at);
+        } else {
+            moveTo(command, slew);
+        }
         lastCommandTime = millis();
-        char message[100];
-        sprintf(message, "[%s] command enable: %d  direction: %d  speed: %d",
-                name, command == 0 ? 0 : 1, command > 0 ? 1 : 0, abs(command));
-        if (nullptr == response) {
-            // Serial.printf("[Stepper %s] handleApiControl() creating response\n", name);
-            response = request->beginResponse(200, "text/plain", message);
-        }
-        Device::handleApiControl(request, response);
-        // Serial.printf("[Stepper %s] handleApiControl() success, sending response\n", name);
-        request->send(response);
-    }
-
-    JSONVar toJSONVar(int mode = JSON_MODE_PRIVATE) {
-        Serial.printf("[Stepper %s] toJSONVar\n", name);
-        JSONVar j = Device::toJSONVar(mode);
-        j["commandMin"] = commandMin;
-        j["commandMax"] = commandMax;
+        if (args.verbose)
+            snprintf(message, size, "[%s] command enable: %d  direction: %d  speed: %d",
+                     name, command == 0 ? 0 : 1, command > 0 ? 1 : 0, abs(command));
+        return 200;
+    }
+
+    void writeJson(JsonWriter &json, int mode = JSON_MODE_PRIVATE) {
+        Device::writeJson(json, mode);
+        json.value("commandMin", commandMin);
+        json.value("commandMax", commandMax);
         if (JSON_MODE_PRIVATE == mode) {
-            j["pinEnable"] = pinEnable;
-            j["pinDirection"] = pinDirection;
-            j["pinPulse"] = pinPulse;
-            j["pulseMin"] = (long)pulseMin;
-            j["pulseMax"] = (long)pulseMax;
-            j["pulseWidth"] = (int)pulseWidth;
+            json.value("pinEnable", pinEnable);
+            json.value("pinDirection", pinDirection);
+            json.value("pinPulse", pinPulse);
+            json.value("pulseMin", pulseMin);
+            json.value("pulseMax", pulseMax);
+            json.value("pulseWidth", pulseWidth);
         }
-        return j;
+    }
+
+    // "name,type,commandMin,commandMax"
+    int toTxt(char *buf, size_t size) {
+        return snprintf(buf, size, "%s,%s,%d,%d", name, type, commandMin, commandMax);
     }
 
    protected:
     void setup() {
-        Serial.printf("[Stepper %s] setup\n", name);
+        LOG_I("[Stepper %s] setup\n", name);
         pinMode(pinEnable, OUTPUT);
         pinMode(pinDirection, OUTPUT);
         pinMode(pinPulse, OUTPUT);
-        digitalWrite(pinEnable, LOW);
-        digitalWrite(pinDirection, HIGH);
-        digitalWrite(pinPulse, LOW);
+        CAPTURE_CHANNEL(pinEnable, name, "enable");
+        CAPTURE_CHANNEL(pinDirection, name, "direction");
+        CAPTURE_CHANNEL(pinPulse, name, "pulse");
+        writePin(pinEnable, LOW);
+        writePin(pinDirection, HIGH);
+        directionLevel = HIGH;
+        writePin(pinPulse, LOW);
     }
 
     void loop() {
         easeCommandToSetPoint();
+        if (0 == this->command) {
+            writePin(pinEnable, LOW);
+            idle();
+            return;
+        }
+        holdAwake(true);
         int command = this->command;
         unsigned long pause = calculatePause();
-        if (0 != this->command) {
-            digitalWrite(pinEnable, HIGH);
-            digitalWrite(pinDirection, 0 < command ? LOW : HIGH);
-        }
+        writePin(pinEnable, HIGH);
+        writeDirection(command);
         while (0 != this->command) {
             easeCommandToSetPoint();
-            digitalWrite(pinPulse, HIGH);
+            writePin(pinPulse, HIGH);
             microDelay(pulseWidth);
-            digitalWrite(pinPulse, LOW);
+            writePin(pinPulse, LOW);
             pulseEndTime = micros64();
+            TRACE_PULSE();
             if (command != this->command) {
-                digitalWrite(pinDirection, 0 < command ? LOW : HIGH);
                 command = this->command;
+                writeDirection(command);
                 pause = calculatePause();
             }
-            microDelay(pause - (micros64() - pulseEndTime));
+            uint64_t elapsed = micros64() - pulseEndTime;
+            if (elapsed < pause) microDelay(pause - elapsed);  // a late pulse goes out at once
+            uint32_t late = micros64() - pulseEndTime - pause;
+            if (stall < late) stall = late;
+            lateness.record(late);
         }
-        digitalWrite(pinEnable, LOW);
+        writePin(pinEnable, LOW);
+    }
+
+    inline void writePin(int pin, int level) {
+        digitalWrite(pin, level);
+        CAPTURE_WRITE(pin, level);
     }
 
+    // Writes the direction pin for [command]. After a real change it waits
+    // out the driver's setup time, so the next pulse cannot come too early.
+    // Stopping leaves the pin as it is.
+    void writeDirection(int command) {
+        if (0 == command) return;
+        int level = 0 < command ? LOW : HIGH;
+        if (level == directionLevel) return;
+        writePin(pinDirection, level);
+        directionLevel = level;
+        waitDirectionSetup();
+    }
+
+    inline void IRAM_ATTR waitDirectionSetup() {
+        uint32_t cycles = directionSetup * ESP.getCpuFreqMHz() / 1000 + 1;
+        uint32_t start = ESP.getCycleCount();
+        while (ESP.getCycleCount() - start < cycles) {
+        }
+    }
+
+    int directionLevel = -1;  // level last written to the direction pin, -1: unknown
+
+    uint32_t stall = 0;  // us, worst lateness of a pulse since takeStall()
+    Histogram lateness;  // us, lateness of every pulse since boot or the last reset
+
     void easeCommandToSetPoint() {
+        if (pending) applyPending();
+        if (slewing) slew();
         if (command == setPoint) return;
         if (command < setPoint) {
             command += changeMax;
@@ -160,6 +499,37 @@ class Stepper : public Device {
         }
     }
 
+    void applyPending() {
+        if ((int32_t)(micros() - pendingAt) < 0) return;
+        pending = false;
+        moveTo(pendingTarget, pendingDuration);
+    }
+
+    // Waits while stopped. A scheduled command keeps the CPU awake and, once
+    // it is less than idleDelay away, is waited for by spinning, so it starts
+    // the motor on time.
+    void idle() {
+        holdAwake(pending);
+        if (pending && (int32_t)(pendingAt - micros()) < idleDelay * 1000) {
+            while ((int32_t)(micros() - pendingAt) < 0)
+                yield();
+            applyPending();
+            return;
+        }
+        delay(idleDelay);
+    }
+
+    // Interpolates the set point along the transition started by moveTo()
+    void slew() {
+        unsigned long elapsed = millis() - slewStart;
+        if (slewDuration <= elapsed) {
+            setPoint = slewTarget;
+            slewing = false;
+            return;
+        }
+        setPoint = slewFrom + (long)(slewTarget - slewFrom) * (long)elapsed / (long)slewDuration;
+    }
+
     unsigned long calculatePause() {
         if (0 == command) {
             return 0;
@@ -183,24 +553,223 @@ class Stepper : public Device {
             max,
             pulseMax,
             pulseMin);
-        Serial.printf(
+        LOG_D(
             "[Stepper %s] calculatePause command: %d (%d ... %d) => pause: %ld (%ld ... %ld)\n",
             name, command, min, max, pause, pulseMin, pulseMax);
         return pause;
     }
 
+    // Keeps the idle task from sleeping while the motor runs
+    void holdAwake(bool hold) {
+        if (hold == awake) return;
+        awake = hold;
+        if (hold)
+            tickless.awake++;
+        else
+            tickless.awake--;
+    }
+
     void microDelay(unsigned long us) {
         if (0 == us) return;
-        unsigned long end = micros() + us;
-        while (micros() < end)
+        uint32_t start = micros();
+        while ((uint32_t)(micros() - start) < us)
             yield();
     }
 
+   public:
+    // Emits [steps] pulses without pauses along the step path of loop() and
+    // returns the achieved rate in steps/s. The driver is left disabled.
+    virtual unsigned long benchmark(int steps = 10000) {
+        pinMode(pinEnable, OUTPUT);
+        pinMode(pinPulse, OUTPUT);
+        digitalWrite(pinEnable, LOW);
+        uint32_t start = ESP.getCycleCount();
+        for (int i = 0; i < steps; i++) {
+            easeCommandToSetPoint();
+            digitalWrite(pinPulse, HIGH);
+            delayMicroseconds(pulseWidth);
+            digitalWrite(pinPulse, LOW);
+            pulseEndTime = micros64();
+        }
+        return cyclesToRate(steps, ESP.getCycleCount() - start);
+    }
+
+#ifdef BENCHMARK
+    // Per call cost of the functions the step loop runs on every pulse
+    void benchmarkCalls(Bench &bench) {
+        int savedCommand = command;
+        int savedSetPoint = setPoint;
+        command = commandMax / 2;
+        volatile unsigned long pause;  // keeps the optimizer from dropping the call
+        bench.run("calculatePause", 1000, [this, &pause]() { pause = calculatePause(); });
+        setPoint = commandMax;
+        bench.run("easeCommandToSetPoint", 1000, [this]() {
+            command = 0;
+            easeCommandToSetPoint();
+        });
+        bench.run("easeCommandToSetPoint slewing", 1000, [this]() {
+            moveTo(commandMax, 1000);
+            command = 0;
+            easeCommandToSetPoint();
+        });
+        moveTo(savedSetPoint);
+        command = savedCommand;
+    }
+#endif
+
+   protected:
+    unsigned long cyclesToRate(int steps, uint32_t cycles) {
+        if (0 == cycles) return 0;
+        return (uint64_t)steps * ESP.getCpuFreqMHz() * 1000000 / cycles;
+    }
+
+    volatile bool pending = false;  // a scheduled command is waiting, set last by schedule()
+    int pendingTarget = 0;
+    unsigned long pendingDuration = 0;
+    uint32_t pendingAt = 0;  // us
+
    private:
+    bool slewing = false;
+    int slewFrom = 0;
+    int slewTarget = 0;
+    unsigned long slewStart = 0;
+    unsigned long slewDuration = 0;
     uint64_t pulseEndTime = 0;
+    bool awake = false;
 };
 
-class Led : public Device {
+// Stepper with the pins fixed at compile time. Edges are written straight to
+// the GPIO set/clear registers and the step loop runs from IRAM, so the pulse
+// train does not depend on digitalWrite() or the flash cache. Each pulse,
+// and the last yieldMargin of the pause before it, are timed by spinning on
+// the cycle counter, with no call out of IRAM. The ramp, the scheduled
+// commands, a new pause and yield() run from flash right after a pulse,
+// where a cache miss only takes from the pause.
+// Only GPIO0..15 are on GPOS/GPOC, GPIO16 (D0) needs the runtime Stepper.
+template <uint8_t PinEnable, uint8_t PinDirection, uint8_t PinPulse>
+class FastStepper : public Stepper {
+    static_assert(PinEnable < 16 && PinDirection < 16 && PinPulse < 16,
+                  "FastStepper pins must be GPIO0..15");
+
+   public:
+    unsigned long yieldMargin = 100;  // us before a pulse that no other task or flash code runs
+
+    FastStepper(
+        const char *name = "Stepper",
+        unsigned long pulseMin = 2000,
+        unsigned long pulseMax = 2000000,
+        unsigned int pulseWidth = 1,
+        int commandMin = -511,
+        int commandMax = 512,
+        int changeMax = 10) : Stepper(name,
+                                      PinEnable,
+                                      PinDirection,
+                                      PinPulse,
+                                      pulseMin,
+                                      pulseMax,
+                                      pulseWidth,
+                                      commandMin,
+                                      commandMax,
+                                      changeMax) {}
+
+    unsigned long IRAM_ATTR benchmark(int steps = 10000) {
+        pinMode(PinEnable, OUTPUT);
+        pinMode(PinPulse, OUTPUT);
+        GPOC = enableMask;
+        StepState state = {command, pulseWidth * ESP.getCpuFreqMHz(), 0};
+        uint32_t start = ESP.getCycleCount();
+        for (int i = 0; i < steps; i++) {
+            easeCommandToSetPoint();
+            GPOS = pulseMask;
+            spin(ESP.getCycleCount(), state.pulseWidth);
+            GPOC = pulseMask;
+            state.pulseEnd = ESP.getCycleCount();
+            if (state.command != command) writeDirection(state.command = command);
+        }
+        return cyclesToRate(steps, ESP.getCycleCount() - start);
+    }
+
+   protected:
+    static constexpr uint32_t enableMask = 1 << PinEnable;
+    static constexpr uint32_t directionMask = 1 << PinDirection;
+    static constexpr uint32_t pulseMask = 1 << PinPulse;
+
+    // what the step loop touches on every pulse, kept together on the stack
+    struct StepState {
+        int command;
+        uint32_t pulseWidth;  // cycles
+        uint32_t pulseEnd;    // cycle count
+    };
+
+    // Waits until [cycles] have passed since [start], without leaving IRAM
+    static inline void IRAM_ATTR spin(uint32_t start, uint32_t cycles) {
+        while (ESP.getCycleCount() - start < cycles) {
+        }
+    }
+
+    void IRAM_ATTR loop() {
+        easeCommandToSetPoint();
+        if (0 == command) {
+            GPOC = enableMask;
+            CAPTURE_MASK(enableMask, 0);
+            idle();
+            return;
+        }
+        holdAwake(true);
+        uint32_t mhz = ESP.getCpuFreqMHz();
+        StepState state = {command, pulseWidth * mhz, 0};
+        uint32_t pause = calculatePause() * mhz;  // cycles, < 2^32 for pauses up to 26 s at 160 MHz
+        uint32_t margin = yieldMargin * mhz;
+        GPOS = enableMask;
+        CAPTURE_MASK(enableMask, 1);
+        writeDirection(state.command);
+        while (true) {
+            GPOS = pulseMask;
+            CAPTURE_MASK(pulseMask, 1);
+            spin(ESP.getCycleCount(), state.pulseWidth);
+            GPOC = pulseMask;
+            CAPTURE_MASK(pulseMask, 0);
+            state.pulseEnd = ESP.getCycleCount();
+            TRACE_PULSE();
+            // flash code from here to the spin, the pause absorbs its cache misses
+            easeCommandToSetPoint();
+            if (state.command != command) {
+                state.command = command;
+                if (0 == state.command) break;
+                writeDirection(state.command);
+                pause = calculatePause() * mhz;
+            }
+            while (margin < pause && ESP.getCycleCount() - state.pulseEnd < pause - margin) {
+                if (pending) applyPending();  // set points change between pulses, on time
+                yield();
+            }
+            spin(state.pulseEnd, pause);
+            uint32_t late = (ESP.getCycleCount() - state.pulseEnd - pause) / mhz;
+            if (stall < late) stall = late;
+            lateness.record(late);
+        }
+        GPOC = enableMask;
+        CAPTURE_MASK(enableMask, 0);
+    }
+
+    // Like Stepper::writeDirection(), through the set/clear registers
+    inline void IRAM_ATTR writeDirection(int command) {
+        if (0 == command) return;
+        int level = 0 < command ? LOW : HIGH;
+        if (level == directionLevel) return;
+        if (LOW == level) {
+            GPOC = directionMask;
+            CAPTURE_MASK(directionMask, 0);
+        } else {
+            GPOS = directionMask;
+            CAPTURE_MASK(directionMask, 1);
+        }
+        directionLevel = level;
+        waitDirectionSetup();
+    }
+};
+
+class Led : public Device, public DeadlineTask {
    public:
     int pin_enable;
     bool invert;
@@ -212,38 +781,164 @@ class Led : public Device {
         this->invert = invert;
     }
 
-    void handleApiControl(AsyncWebServerRequest *request, AsyncWebServerResponse *response = nullptr) {
-        Device::handleApiControl(request, response);
+    AbstractTask *task() {
+        return this;
+    }
+
+    int control(ControlArgs &args, char *message, size_t size) {
+        const char *enable = args.get("enable");
         bool enabled = false;
-        if (
-            ('t' == request->arg("enable").c_str()[0]) ||  // "true"
-            (0 < request->arg("enable").toInt()))          // 1
+        if (nullptr != enable &&
+            ('t' == enable[0] ||    // "true"
+             0 < atoi(enable)))     // 1
             enabled = true;
 
         this->enabled = enabled;
-        char message[100];
-        sprintf(message, "[%s] command enable: %s", name,
-                enabled ? "true" : "false");
-        request->send(200, "text/plain", message);
-        Serial.println(message);
+        write();
+        if (args.verbose)
+            snprintf(message, size, "[%s] command enable: %s", name, enabled ? "true" : "false");
+        LOG_D("[%s] command enable: %s\n", name, enabled ? "true" : "false");
+        return 200;
+    }
+
+    bool apply(int command, unsigned long slew = 0) {
+        enabled = 0 < command;
+        write();
+        return true;
     }
 
-    JSONVar toJSONVar(int mode = JSON_MODE_PRIVATE) {
-        JSONVar j = Device::toJSONVar(mode);
+    void writeJson(JsonWriter &json, int mode = JSON_MODE_PRIVATE) {
+        Device::writeJson(json, mode);
         if (JSON_MODE_PRIVATE == mode) {
-            j["pin_enable"] = pin_enable;
+            json.value("pin_enable", pin_enable);
         }
-        return j;
     }
 
    protected:
     void setup() {
         pinMode(pin_enable, OUTPUT);
+        CAPTURE_CHANNEL(pin_enable, name, "led");
+        write();
     }
 
+    // The pin is written when a command arrives, the loop only refreshes it
     void loop() {
-        digitalWrite(pin_enable, invert ? !enabled : enabled ? HIGH
-                                                             : LOW);
+        write();
+        sleep(1000);
+    }
+
+    void write() {
+        int level = invert ? !enabled : enabled ? HIGH : LOW;
+        digitalWrite(pin_enable, level);
+        CAPTURE_WRITE(pin_enable, level);
+    }
+};
+
+// Stepper that streams its pulse train through I2S DMA. The loop only
+// renders upcoming steps into the DMA buffers, so pulse timing does not
+// jitter with WiFi activity and CPU cost does not grow with the step rate.
+// Pulses come out on the I2S data pin (GPIO3/RX, so no serial input), I2S
+// also drives GPIO2 (WS) and GPIO15 (BCK). Enable and direction stay on GPIO.
+// The price is latency and ramp resolution: the speed is eased once per
+// refill, every refillDelay (2 ms), not once per pulse, and a new command
+// reaches the pin only after the samples already queued in DMA, up to 16 ms
+// at 1 MHz (8 buffers of 64 32-bit samples). Selected by -DI2S_STEPPER.
+class I2sStepper : public Stepper {
+   public:
+    uint32_t tickRate = 1000000;  // I2S bit clock, ticks/s, one tick is one bit
+    int refillDelay = 2;          // ms between refills, must stay well below the buffered time
+    int drainDelay = 20;          // ms to play out the buffered samples before a direction change
+
+    I2sStepper(
+        const char *name = "Stepper",
+        int pinEnable = 0,
+        int pinDirection = 0,
+        unsigned long pulseMin = 2000,
+        unsigned long pulseMax = 2000000,
+        unsigned int pulseWidth = 1,
+        int commandMin = -511,
+        int commandMax = 512,
+        int changeMax = 10) : Stepper(name,
+                                      pinEnable,
+                                      pinDirection,
+                                      I2S_DATA_PIN,
+                                      pulseMin,
+                                      pulseMax,
+                                      pulseWidth,
+                                      commandMin,
+                                      commandMax,
+                                      changeMax) {}
+
+   protected:
+    static const int I2S_DATA_PIN = 3;
+    StepWaveform waveform;
+    uint32_t samples[32];
+    int renderedCommand = 0;
+
+    void setup() {
+        LOG_I("[I2sStepper %s] setup\n", name);
+        pinMode(pinEnable, OUTPUT);
+        pinMode(pinDirection, OUTPUT);
+        CAPTURE_CHANNEL(pinEnable, name, "enable");
+        CAPTURE_CHANNEL(pinDirection, name, "direction");  // the pulses come from DMA, out of sight
+        writePin(pinEnable, LOW);
+        writePin(pinDirection, HIGH);
+        directionLevel = HIGH;
+        i2s_rxtx_begin(false, true);
+        i2s_set_rate(tickRate / 32);  // a stereo 16 bit sample is 32 ticks
+        waveform.pulseWidth = toTicks(pulseWidth);
+    }
+
+    void loop() {
+        easeCommandToSetPoint();
+        if (command != renderedCommand) {
+            if (0 != renderedCommand && (0 < command) != (0 < renderedCommand)) {
+                // let the pulses of the old direction play out first
+                waveform.period = 0;
+                refill();
+                delay(drainDelay);
+                refill();
+            }
+            if (0 == command) {
+                waveform.period = 0;
+            } else {
+                writePin(pinEnable, HIGH);
+                writeDirection(command);
+                bool stopped = 0 == waveform.period;
+                waveform.period = toTicks(calculatePause() + pulseWidth);
+                if (stopped) waveform.restart();
+            }
+            renderedCommand = command;
+        }
+        refill();
+        if (0 == command && 0 == waveform.period) {
+            delay(drainDelay);
+            refill();
+            if (0 == command) {
+                writePin(pinEnable, LOW);
+                holdAwake(false);
+                delay(idleDelay);
+                return;
+            }
+        }
+        holdAwake(true);  // the DMA buffers hold less than the idle task may sleep
+        delay(refillDelay);
+    }
+
+    // Tops up the DMA buffers with the rendered waveform
+    void refill() {
+        uint16_t available = i2s_available();
+        while (0 < available) {
+            int count = available < 32 ? available : 32;
+            waveform.render(samples, count);
+            for (int i = 0; i < count; i++)
+                i2s_write_sample_nb(samples[i]);
+            available -= count;
+        }
+    }
+
+    uint32_t toTicks(unsigned long us) {
+        return (uint64_t)us * tickRate / 1000000;
     }
 };
 
@@ -0,0 +1,176 @@
+#ifndef GROUPRECEIVER_H
+#define GROUPRECEIVER_H
+
+#include <groupcommand.h>
+#include <log.h>
+#include <tickless.h>
+#include <trace.h>
+#include <frametransport.h>
+
+#include "config.h"
+
+#define GROUP_MAX_TRANSPORTS 3
+
+// Where the last accepted group command of a device came from
+struct GroupState {
+    uint32_t session;
+    uint32_t sequence;
+    uint32_t owner;
+};
+
+// Applies the group commands sent by remotes to the devices that follow
+// the group, and announces those devices with beacons. A group command
+// takes the device's lease like a control request, a repeat of the last
+// one only renews it. The same command arriving over several transports
+// is applied once.
+//
+// Also watches the links of remotes that send heartbeats: a heartbeat
+// renews the leases its sender holds, on any device, and a device whose
+// owner falls silent for the timeout the heartbeats ask for is stopped
+// within a poll, along its ramp, and its lease released.
+class GroupReceiver : public DeadlineTask {
+   public:
+    Config *config = nullptr;
+    unsigned long pollDelay = 10;          // ms between checks for frames
+    unsigned long beaconInterval = 2000;   // ms
+    uint32_t received = 0;
+    uint32_t applied = 0;
+    uint32_t dropped = 0;  // malformed, stale or refused by a lease
+    uint32_t heartbeats = 0;
+    uint32_t linksLost = 0;
+    unsigned long linkTimeoutMin = 100;  // ms, heartbeats asking for less are held to this
+
+    void setConfig(Config *config) {
+        this->config = config;
+    }
+
+    bool addTransport(Transport *transport) {
+        if (GROUP_MAX_TRANSPORTS <= transportCount) return false;
+        transports[transportCount++] = transport;
+        return true;
+    }
+
+   protected:
+    Transport *transports[GROUP_MAX_TRANSPORTS];
+    int transportCount = 0;
+    GroupState states[MAX_DEVICES];
+    unsigned long lastBeacon = 0;
+
+    void setup() {
+        for (int i = 0; i < MAX_DEVICES; i++)
+            states[i] = {0, 0, 0};
+    }
+
+    void loop() {
+        TRACE_SCOPE(TRACE_TRACK_LOOP, "groupReceiver");
+        uint8_t frame[TRANSPORT_FRAME_SIZE];
+        for (int t = 0; t < transportCount; t++) {
+            size_t size;
+            while (0 < (size = transports[t]->receive(frame, sizeof(frame)))) {
+                uint32_t magic;
+                memcpy(&magic, frame, sizeof(magic));
+                if (GROUP_BEACON_MAGIC == magic) continue;  // from another server
+                if (GROUP_HEARTBEAT_MAGIC == magic && sizeof(GroupHeartbeat) == size) {
+                    GroupHeartbeat *heartbeat = (GroupHeartbeat *)frame;
+                    heartbeat->client[GROUP_CLIENT_SIZE - 1] = '\0';
+                    receive(*heartbeat);
+                    continue;
+                }
+                received++;
+                if (sizeof(GroupCommand) != size || GROUP_MAGIC != magic) {
+                    dropped++;
+                    continue;
+                }
+                GroupCommand *datagram = (GroupCommand *)frame;
+                datagram->group[GROUP_NAME_SIZE - 1] = '\0';
+                datagram->client[GROUP_CLIENT_SIZE - 1] = '\0';
+                receive(*datagram);
+            }
+        }
+        watchLinks();
+        if (beaconInterval <= millis() - lastBeacon) {
+            lastBeacon = millis();
+            sendBeacons();
+        }
+        sleep(pollDelay);
+    }
+
+    void receive(GroupCommand &datagram) {
+        if (nullptr == config) return;
+        uint32_t owner = ownerOf(datagram.client);
+        config->hear(owner);  // the sender sends no heartbeats while it sends commands
+        for (int i = 0; i < config->deviceCount; i++) {
+            Device *device = config->devices[i];
+            if ('\0' == *device->group || 0 != strcmp(datagram.group, device->group)) continue;
+            GroupState *state = &states[i];
+            bool sameSender = owner == state->owner && datagram.session == state->session;
+            int32_t age = state->sequence - datagram.sequence;
+            if (sameSender && 0 < age) {
+                dropped++;  // reordered, a newer one has been applied
+                continue;
+            }
+            if (!device->lease.acquire(owner, 0, config->leaseTime)) {
+                dropped++;
+                record(i, owner, datagram, 409);
+                continue;
+            }
+            if (sameSender && 0 == age) continue;  // a refresh or a copy, the lease is renewed
+            state->owner = owner;
+            state->session = datagram.session;
+            state->sequence = datagram.sequence;
+            if (device->apply(datagram.command, datagram.slew)) applied++;
+            record(i, owner, datagram, 200);
+            LOG_D("[Group] %s: %d from %08x #%u\n", device->name, datagram.command, owner, datagram.sequence);
+        }
+    }
+
+    void receive(GroupHeartbeat &heartbeat) {
+        if (nullptr == config) return;
+        heartbeats++;
+        uint32_t owner = ownerOf(heartbeat.client);
+        unsigned long timeout = heartbeat.timeout < linkTimeoutMin ? linkTimeoutMin : heartbeat.timeout;
+        for (int i = 0; i < config->deviceCount; i++)
+            config->devices[i]->lease.heartbeat(owner, timeout, config->leaseTime);
+    }
+
+    void watchLinks() {
+        if (nullptr == config) return;
+        unsigned long t = millis();
+        for (int i = 0; i < config->deviceCount; i++) {
+            Device *device = config->devices[i];
+            if (!device->lease.lost(t)) continue;
+            LOG_W("[Link] %s: no heartbeat from %08x for %lu ms, stopping\n",
+                  device->name, device->lease.owner, t - device->lease.heard);
+            TRACE_INSTANT(TRACE_TRACK_LOOP, "linkLost");
+            device->lease.release();
+            device->stop();
+            states[i] = {0, 0, 0};  // the sender's next frame, even a repeat, applies again
+            linksLost++;
+        }
+    }
+
+    void record(int device, uint32_t owner, GroupCommand &datagram, int status) {
+        if (nullptr == config->recorder) return;
+        config->recorder->record(device, owner, datagram.command, datagram.slew, 0, 0, status, RECORD_ORIGIN_GROUP);
+    }
+
+    void sendBeacons() {
+        if (nullptr == config) return;
+        GroupBeacon beacon;
+        memset(&beacon, 0, sizeof(beacon));
+        beacon.magic = GROUP_BEACON_MAGIC;
+        strncpy(beacon.host, config->name, GROUP_NAME_SIZE - 1);
+        beacon.rate = config->rate;
+        for (int i = 0; i < config->deviceCount; i++) {
+            Device *device = config->devices[i];
+            if ('\0' == *device->group) continue;
+            strncpy(beacon.group, device->group, GROUP_NAME_SIZE - 1);
+            int len = device->toTxt(beacon.summary, GROUP_SUMMARY_SIZE);
+            if (len < 0 || GROUP_SUMMARY_SIZE <= len) continue;
+            for (int t = 0; t < transportCount; t++)
+                transports[t]->send((uint8_t *)&beacon, sizeof(beacon));
+        }
+    }
+} groupReceiver;
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <Arduino.h>
+
+#define JSONWRITER_MAX_DEPTH 16
+
+// Writes JSON straight to a Print (e.g. an AsyncResponseStream) without
+// building a document, only the nesting state is kept.
+// Inside objects pass a key, inside arrays pass nullptr:
+//     json.beginObject().value("name", name).beginArray("devices")...
+class JsonWriter {
+   public:
+    JsonWriter(Print *out) {
+        this->out = out;
+    }
+
+    JsonWriter &beginObject(const char *key = nullptr) {
+        return open(key, '{');
+    }
+
+    JsonWriter &endObject() {
+        return close('}');
+    }
+
+    JsonWriter &beginArray(const char *key = nullptr) {
+        return open(key, '[');
+    }
+
+    JsonWriter &endArray() {
+        return close(']');
+    }
+
+    JsonWriter &value(const char *key, const char *value) {
+        this->key(key);
+        if (nullptr == value)
+            out->print("null");
+        else
+            string(value);
+        return *this;
+    }
+
+    JsonWriter &value(const char *key, bool value) {
+        this->key(key);
+        out->print(value ? "true" : "false");
+        return *this;
+    }
+
+    JsonWriter &value(const char *key, int value) {
+        this->key(key);
+        out->printf("%d", value);
+        return *this;
+    }
+
+    JsonWriter &value(const char *key, unsigned int value) {
+        this->key(key);
+        out->printf("%u", value);
+        return *this;
+    }
+
+    JsonWriter &value(const char *key, long value) {
+        this->key(key);
+        out->printf("%ld", value);
+        return *this;
+    }
+
+    JsonWriter &value(const char *key, unsigned long value) {
+        this->key(key);
+        out->printf("%lu", value);
+        return *this;
+    }
+
+   protected:
+    Print *out;
+    int depth = 0;
+    bool first[JSONWRITER_MAX_DEPTH + 1] = {true};
+
+    JsonWriter &open(const char *key, char bracket) {
+        this->key(key);
+        out->print(bracket);
+        if (depth < JSONWRITER_MAX_DEPTH) depth++;
+        first[depth] = true;
+        return *this;
+    }
+
+    JsonWriter &close(char bracket) {
+        out->print(bracket);
+        if (0 < depth) depth--;
+        return *this;
+    }
+
+    // Separator and, inside objects, the key of the next value
+    void key(const char *key) {
+        if (!first[depth]) out->print(',');
+        first[depth] = false;
+        if (nullptr == key) return;
+        string(key);
+        out->print(':');
+    }
+
+    void string(const char *s) {
+        out->print('"');
+        for (; '\0' != *s; s++) {
+            switch (*s) {
+                case '"':
+                    out->print("\\\"");
+                    break;
+                case '\\':
+                    out->print("\\\\");
+                    break;
+                case '\n':
+                    out->print("\\n");
+                    break;
+                default:
+                    if ((unsigned char)*s < 0x20)
+                        out->printf("\\u%04x", *s);
+                    else
+                        out->print(*s);
+            }
+        }
+        out->print('"');
+    }
+};
+
+#endif
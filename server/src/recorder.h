@@ -0,0 +1,169 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include <log.h>
+#include <tickless.h>
+#include <trace.h>
+
+#include "devices.h"
+
+#ifndef RECORDER_SIZE
+#define RECORDER_SIZE 256  // records kept in RAM, 24 bytes each
+#endif
+#define RECORDING_MAGIC 0x31524d43  // "CMR1"
+#define RECORDING_FILE "/commands.bin"
+#define RECORDING_FILE_OLD "/commands.old"
+
+#define RECORD_ORIGIN_HTTP 0
+#define RECORD_ORIGIN_GROUP 1
+#define RECORD_ORIGIN_BOOT 2  // marks a boot in a file, only time is set
+
+// A control command as it arrived, stored as the ESP8266 lays it out
+// (little endian, packed)
+struct __attribute__((packed)) CommandRecord {
+    uint32_t time;     // ms since boot
+    uint32_t owner;    // controller, see ControlArgs::owner()
+    int32_t command;   // "command", or "enable" as 0 or 1
+    int32_t at;        // us from arrival to the scheduled start, 0: started at once
+    uint16_t slew;     // ms
+    uint16_t status;   // HTTP status the command got
+    uint8_t device;    // index in Config::devices
+    int8_t priority;
+    uint8_t origin;    // RECORD_ORIGIN_*
+    uint8_t reserved;
+};
+
+// Start of a recording, downloaded or in a file, the records follow oldest first
+struct __attribute__((packed)) RecordingHeader {
+    uint32_t magic;
+    uint16_t recordSize;
+    uint16_t reserved;
+};
+
+// Keeps the last RECORDER_SIZE control commands, from requests and groups,
+// so a glitch can be reproduced from what the remotes really sent. With
+// persist set the records are also appended to RECORDING_FILE every
+// flushInterval; once the file reaches fileMax it becomes RECORDING_FILE_OLD
+// and a new one is started. Since the times restart at every boot, the first
+// flush after one appends a RECORD_ORIGIN_BOOT record before the others, and
+// so does the first one into a new file, which is replayed on its own.
+class CommandRecorder : public DeadlineTask {
+   public:
+    bool persist = false;
+    unsigned long flushInterval = 10000;  // ms, batches the writes to flash
+    size_t fileMax = 65536;               // bytes
+    bool paused = false;                  // e.g. while a recording is replayed
+    uint32_t total = 0;                   // records since boot
+    uint32_t lost = 0;                    // records overwritten before they were persisted
+
+    void record(int device, uint32_t owner, ControlArgs &args, int status) {
+        int command = 0;
+        if (!args.getInt("command", &command)) {
+            const char *enable = args.get("enable");
+            command = nullptr != enable && ('t' == enable[0] || 0 < atoi(enable));
+        }
+        int slew = 0;
+        args.getInt("slew", &slew);
+        int priority = 0;
+        args.getInt("priority", &priority);
+        uint32_t at;
+        int32_t delay = args.getUnsigned("at", &at) ? at - micros() : 0;
+        record(device, owner, command, slew, delay, priority, status, RECORD_ORIGIN_HTTP);
+    }
+
+    void record(int device, uint32_t owner, int command, unsigned long slew, int32_t at,
+                int priority, int status, uint8_t origin) {
+        if (paused || device < 0) return;
+        CommandRecord *r = &records[total % RECORDER_SIZE];
+        r->time = millis();
+        r->owner = owner;
+        r->command = command;
+        r->at = at;
+        r->slew = slew < UINT16_MAX ? slew : UINT16_MAX;
+        r->status = status;
+        r->device = device;
+        r->priority = priority;
+        r->origin = origin;
+        r->reserved = 0;
+        total++;
+    }
+
+    // Sequence number of the oldest record still in RAM
+    uint32_t first() {
+        return total < RECORDER_SIZE ? 0 : total - RECORDER_SIZE;
+    }
+
+    // The record with sequence number [seq], nullptr if it is not in RAM
+    const CommandRecord *get(uint32_t seq) {
+        if (seq < first() || total <= seq) return nullptr;
+        return &records[seq % RECORDER_SIZE];
+    }
+
+    void writeHeader(Print &out) {
+        RecordingHeader header = {RECORDING_MAGIC, sizeof(CommandRecord), 0};
+        out.write((const uint8_t *)&header, sizeof(header));
+    }
+
+    // Writes the records in RAM as a recording
+    void writeTo(Print &out) {
+        writeHeader(out);
+        for (uint32_t seq = first(); seq < total; seq++)
+            out.write((const uint8_t *)get(seq), sizeof(CommandRecord));
+    }
+
+    bool mount() {
+        if (!mounted) mounted = LittleFS.begin();
+        return mounted;
+    }
+
+   protected:
+    CommandRecord records[RECORDER_SIZE];
+    uint32_t persisted = 0;  // sequence number of the next record to append to the file
+    bool mounted = false;
+    bool bootMarked = false;  // the file has the RECORD_ORIGIN_BOOT record of this boot
+
+    void loop() {
+        if (persist) flush();
+        sleep(flushInterval);
+    }
+
+    void flush() {
+        if (persisted == total) return;
+        TRACE_SCOPE(TRACE_TRACK_LOOP, "recorder.flush");
+        if (!mount()) {
+            LOG_E("[Recorder] Cannot mount LittleFS, not persisting\n");
+            persist = false;
+            return;
+        }
+        if (persisted < first()) {
+            lost += first() - persisted;
+            persisted = first();
+        }
+        File file = LittleFS.open(RECORDING_FILE, "a");
+        if (!file) {
+            LOG_E("[Recorder] Cannot open %s\n", RECORDING_FILE);
+            return;
+        }
+        if (0 == file.size()) writeHeader(file);
+        if (!bootMarked) {
+            CommandRecord boot = {};
+            boot.origin = RECORD_ORIGIN_BOOT;
+            file.write((const uint8_t *)&boot, sizeof(boot));
+            bootMarked = true;
+        }
+        for (; persisted < total; persisted++)
+            file.write((const uint8_t *)get(persisted), sizeof(CommandRecord));
+        bool full = fileMax <= file.size();
+        file.close();
+        if (!full) return;
+        LittleFS.remove(RECORDING_FILE_OLD);
+        LittleFS.rename(RECORDING_FILE, RECORDING_FILE_OLD);
+        bootMarked = false;
+        LOG_I("[Recorder] %s full, moved to %s\n", RECORDING_FILE, RECORDING_FILE_OLD);
+    }
+} recorder;
+
+#endif
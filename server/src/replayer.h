@@ -0,0 +1,158 @@
+#ifndef REPLAYER_H
+#define REPLAYER_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include <log.h>
+#include <tickless.h>
+#include <trace.h>
+
+#include "config.h"
+#include "recorder.h"
+
+// Feeds a recording back through Config::control() with the original
+// spacing divided by [speed], or back to back with speed 0, so a recorded
+// glitch or a production trace can be rerun as a workload. The source is
+// either the recorder's RAM, or a recording file on LittleFS: the one the
+// recorder persists, or one from another server put into data/ and
+// uploaded with "pio run -t uploadfs". Slew and schedule delays are scaled
+// like the spacing, lease times are not, so at other speeds than 1 leases
+// may refuse commands differently: replies that differ from the recorded
+// status are counted as mismatched. The recorder is paused while replaying.
+// At a boot in the recording, or wherever the times go backwards, the
+// spacing restarts from the next record.
+class Replayer : public DeadlineTask {
+   public:
+    Config *config = nullptr;
+    bool running = false;
+    uint32_t replayed = 0;
+    uint32_t mismatched = 0;
+
+    void setConfig(Config *config) {
+        this->config = config;
+    }
+
+    // Replays the records in RAM, or those in [path] if it is set
+    bool start(int speed, const char *path = nullptr) {
+        if (running || nullptr == config || speed < 0) return false;
+        if (nullptr != path) {
+            if (!recorder.mount()) return false;
+            file = LittleFS.open(path, "r");
+            RecordingHeader header;
+            if (!file ||
+                sizeof(header) != file.read((uint8_t *)&header, sizeof(header)) ||
+                RECORDING_MAGIC != header.magic ||
+                sizeof(CommandRecord) != header.recordSize) {
+                LOG_W("[Replay] %s is not a recording\n", path);
+                if (file) file.close();
+                return false;
+            }
+        } else {
+            next = recorder.first();
+            end = recorder.total;
+            if (next == end) return false;
+        }
+        fromFile = nullptr != path;
+        this->speed = speed;
+        replayed = 0;
+        mismatched = 0;
+        loaded = false;
+        startTime = 0;
+        recorder.paused = true;
+        running = true;
+        LOG_I("[Replay] Starting from %s at %dx\n", fromFile ? path : "RAM", speed);
+        notify();
+        return true;
+    }
+
+    void stop() {
+        if (!running) return;
+        if (fromFile) file.close();
+        running = false;
+        recorder.paused = false;
+        LOG_I("[Replay] Done, %u commands, %u mismatched\n", replayed, mismatched);
+    }
+
+   protected:
+    File file;
+    bool fromFile = false;
+    uint32_t next = 0;  // sequence number of the next record in RAM
+    uint32_t end = 0;
+    int speed = 1;
+    CommandRecord record;
+    bool loaded = false;
+    uint32_t firstTime = 0;      // ms, of the first record since the start or a boot
+    uint32_t lastTime = 0;       // ms, of the previous record
+    unsigned long startTime = 0;  // ms, when the record at firstTime was replayed
+
+    void loop() {
+        if (!running) {
+            waitForEvent();
+            return;
+        }
+        if (!loaded) {
+            if (!load()) {
+                stop();
+                return;
+            }
+            loaded = true;
+        }
+        if (RECORD_ORIGIN_BOOT == record.origin) {
+            startTime = 0;
+            loaded = false;
+            return;
+        }
+        unsigned long now = millis();
+        if (0 == startTime || (int32_t)(record.time - lastTime) < 0) {
+            startTime = now;
+            firstTime = record.time;
+        }
+        lastTime = record.time;
+        unsigned long dueTime = startTime + (0 == speed ? 0 : (record.time - firstTime) / speed);
+        if ((long)(now - dueTime) < 0) {
+            wakeAt(dueTime);
+            return;
+        }
+        apply();
+        loaded = false;
+    }
+
+    bool load() {
+        if (fromFile)
+            return sizeof(record) == file.read((uint8_t *)&record, sizeof(record));
+        const CommandRecord *r = recorder.get(next++);
+        if (nullptr == r || end < next) return false;
+        record = *r;
+        return true;
+    }
+
+    void apply() {
+        TRACE_SCOPE(TRACE_TRACK_LOOP, "replay");
+        int scale = 0 == speed ? 1 : speed;
+        char device[4], command[12], slew[8], priority[5], at[12];
+        snprintf(device, sizeof(device), "%u", record.device);
+        snprintf(command, sizeof(command), "%d", record.command);
+        snprintf(slew, sizeof(slew), "%u", record.slew / scale);
+        snprintf(priority, sizeof(priority), "%d", record.priority);
+        snprintf(at, sizeof(at), "%u", (uint32_t)(micros() + record.at / scale));
+        const char *pairs[] = {
+            "device", device,
+            "command", command,
+            "enable", command,
+            "slew", slew,
+            "priority", priority,
+            "at", at,  // last, left out for commands that were not scheduled
+        };
+        ControlArgs args(pairs, 0 == record.at ? 5 : 6, record.owner);
+        char message[100] = "";
+        int status = config->control(args, message, sizeof(message));
+        replayed++;
+        if (status != record.status) {
+            mismatched++;
+            LOG_D("[Replay] %u: %d instead of %u %s\n", replayed, status, record.status, message);
+        }
+    }
+} replayer;
+
+#endif
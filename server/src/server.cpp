@@ -4,23 +4,53 @@
 #include <ESPAsyncWebServer.h>
 #include <Scheduler.h>  // https://github.com/nrwiersma/ESP8266Scheduler
 #include <ESP8266mDNS.h>
-#include <Arduino_JSON.h>
+
+#include <heapmonitor.h>
+#include <log.h>
+#include <pincapture.h>
+#include <stackmonitor.h>
+#include <trace.h>
+#include <transport.h>
+#include <virtualtime.h>
 
 #include "ui.html.h"
+#include "admission.h"
+#include "adaptiverate.h"
+#include "groupreceiver.h"
 #include "config.h"
+#include "recorder.h"
+#include "replayer.h"
 #include "credentials.h"
 
 #define API_PORT 50123  // https://www.iana.org/assignments/service-names-port-numbers/service-names-port-numbers.txt
-#define JSON_LENGTH 512
 #define HTML_LENGTH 8192
 
 Config config;
-Stepper stepper1;
+#ifdef I2S_STEPPER
+I2sStepper stepper1("Stepper", D1, D2);  // enable, direction, pulses on GPIO3
+#else
+FastStepper<D1, D2, D3> stepper1;  // enable, direction, pulse
+#endif
 
 AsyncWebServer server(API_PORT);
-char configJson[JSON_LENGTH];
 char uiHtml[HTML_LENGTH];
 
+HandlerHeapStats* heapUi = heapMonitor.addHandler("ui");
+HandlerHeapStats* heapControl = heapMonitor.addHandler("control");
+HandlerHeapStats* heapConfig = heapMonitor.addHandler("config");
+HandlerHeapStats* heapLog = heapMonitor.addHandler("log");
+HandlerHeapStats* heapStats = heapMonitor.addHandler("stats");
+HandlerHeapStats* heapTime = heapMonitor.addHandler("time");
+HandlerHeapStats* heapRecording = heapMonitor.addHandler("recording");
+HandlerHeapStats* heapReplay = heapMonitor.addHandler("replay");
+#ifdef TRACE
+HandlerHeapStats* heapTrace = heapMonitor.addHandler("trace");
+#endif
+#ifdef PIN_CAPTURE
+HandlerHeapStats* heapCapture = heapMonitor.addHandler("capture");
+#endif
+HandlerHeapStats* heapNotFound = heapMonitor.addHandler("notFound");
+
 String htmlProcessor(const String& var) {
     if (var == "FQDN_OR_IP")
         return WIFI_STA == WiFi.getMode()       //
@@ -32,25 +62,279 @@ String htmlProcessor(const String& var) {
 }
 
 void handleWebUI(AsyncWebServerRequest* request) {
-    Serial.println("[HTTP] handleWebUI()");
+    HeapProbe probe(heapUi);
+    TRACE_SCOPE(TRACE_TRACK_HTTP, "/ui");
+    if (!admission.admit(request)) return;
+    LOG_D("[HTTP] handleWebUI()\n");
     AsyncWebServerResponse* response = request->beginResponse_P(200, "text/html", indexHtmlTemplate, htmlProcessor);
     response->addHeader("Access-Control-Allow-Origin", "*");
     request->send(response);
 }
 
 void handleApiControl(AsyncWebServerRequest* request) {
+    HeapProbe probe(heapControl);
+    TRACE_SCOPE(TRACE_TRACK_HTTP, "/api/control");
+    if (!admission.admit(request, true)) return;
     // Serial.println("[HTTP] handleApiControl()");
+    uint32_t start = micros();
     config.handleApiControl(request);
+    adaptiveRate.recordLatency(micros() - start);
 }
 
 void handleApiConfig(AsyncWebServerRequest* request) {
+    HeapProbe probe(heapConfig);
+    TRACE_SCOPE(TRACE_TRACK_HTTP, "/api/config");
+    if (!admission.admit(request)) return;
     // Serial.println("[HTTP] handleApiConfig()");
-    AsyncWebServerResponse* response = request->beginResponse(200, "application/json", configJson);
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    JsonWriter json(response);
+    config.writeJson(json, JSON_MODE_PUBLIC);
+    response->addHeader("Access-Control-Allow-Origin", "*");
+    request->send(response);
+}
+
+// Drains the pending log messages into the response
+void handleApiLog(AsyncWebServerRequest* request) {
+    HeapProbe probe(heapLog);
+    TRACE_SCOPE(TRACE_TRACK_HTTP, "/api/log");
+    if (!admission.admit(request)) return;
+    AsyncResponseStream* response = request->beginResponseStream("text/plain");
+    char line[LOG_LINE_SIZE];
+    while (0 <= logBuffer.peek(line, sizeof(line))) {
+        response->print(line);
+        logBuffer.pop();
+    }
+    response->addHeader("Access-Control-Allow-Origin", "*");
+    request->send(response);
+}
+
+// Current micros(), clients estimate their offset to it from the round trip
+// and schedule commands on this clock with the "at" parameter of /api/control
+void handleApiTime(AsyncWebServerRequest* request) {
+    HeapProbe probe(heapTime);
+    TRACE_SCOPE(TRACE_TRACK_HTTP, "/api/time");
+    char now[12];
+    snprintf(now, sizeof(now), "%u", (uint32_t)micros());
+    if (!admission.admit(request)) return;
+    request->send(200, "text/plain", now);
+}
+
+// The recent control commands as a binary recording, see recorder.h.
+// ?file=1 sends the persisted recording instead, ?file=old the one before.
+void handleApiRecording(AsyncWebServerRequest* request) {
+    HeapProbe probe(heapRecording);
+    TRACE_SCOPE(TRACE_TRACK_HTTP, "/api/recording");
+    if (!admission.admit(request)) return;
+    const char* file = request->hasParam("file") ? request->getParam("file")->value().c_str() : nullptr;
+    if (nullptr != file) {
+        const char* path = 0 == strcmp("old", file) ? RECORDING_FILE_OLD : RECORDING_FILE;
+        if (!recorder.mount() || !LittleFS.exists(path)) {
+            request->send(404, "text/plain", "No recording");
+            return;
+        }
+        request->send(LittleFS, path, "application/octet-stream", true);
+        return;
+    }
+    AsyncResponseStream* response = request->beginResponseStream("application/octet-stream");
+    recorder.writeTo(*response);
+    response->addHeader("Content-Disposition", "attachment; filename=\"commands.bin\"");
+    response->addHeader("Access-Control-Allow-Origin", "*");
+    request->send(response);
+}
+
+// ?speed=N replays the recent commands N times as fast, 0 back to back,
+// ?file=1 or ?file=old replays a recording file instead, ?stop=1 stops
+void handleApiReplay(AsyncWebServerRequest* request) {
+    HeapProbe probe(heapReplay);
+    TRACE_SCOPE(TRACE_TRACK_HTTP, "/api/replay");
+    if (!admission.admit(request)) return;
+    if (request->hasParam("stop")) {
+        replayer.stop();
+        request->send(200, "text/plain", "Stopped");
+        return;
+    }
+    int speed = request->hasParam("speed") ? request->getParam("speed")->value().toInt() : 1;
+    const char* path = nullptr;
+    if (request->hasParam("file"))
+        path = request->getParam("file")->value() == "old" ? RECORDING_FILE_OLD : RECORDING_FILE;
+    if (replayer.running) {
+        request->send(409, "text/plain", "Already replaying");
+        return;
+    }
+    if (!replayer.start(speed, path)) {
+        request->send(404, "text/plain", "Nothing to replay");
+        return;
+    }
+    request->send(200, "text/plain", "Replaying");
+}
+
+#ifdef TRACE
+// The events recorded since the last call in Chrome trace format, open it
+// in chrome://tracing or ui.perfetto.dev. Recording stops while the events
+// are sent and starts over once they are, with ?pulses=1 also tracing every
+// stepper pulse. An export cut short leaves recording off until the next.
+void handleApiTrace(AsyncWebServerRequest* request) {
+    HeapProbe probe(heapTrace);
+    if (!admission.admit(request)) return;
+    bool pulses = request->hasParam("pulses");
+    trace.beginExport();
+    AsyncWebServerResponse* response = request->beginChunkedResponse(
+        "application/json",
+        [pulses](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+            size_t len = trace.read(buffer, maxLen);
+            if (0 == len) {
+                trace.pulses = pulses;
+                trace.endExport();
+            }
+            return len;
+        });
+    response->addHeader("Access-Control-Allow-Origin", "*");
+    request->send(response);
+}
+#endif
+
+#ifdef PIN_CAPTURE
+// ?arm=1 starts a capture of the stepper and LED pins, which runs until the
+// buffer is full. Then the capture downloads as a VCD file, or with
+// ?metrics=1 the step timing derived from it, in windows of ?window= ms.
+void handleApiCapture(AsyncWebServerRequest* request) {
+    HeapProbe probe(heapCapture);
+    if (!admission.admit(request)) return;
+    if (request->hasParam("arm")) {
+        pinCapture.arm();
+        request->send(200, "text/plain", "Armed");
+        return;
+    }
+    if (request->hasParam("metrics")) {
+        uint32_t window = request->hasParam("window") ? request->getParam("window")->value().toInt() : 100;
+        if (0 == window) window = 100;
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        JsonWriter json(response);
+        json.beginObject()
+            .value("armed", pinCapture.armed)
+            .value("edges", pinCapture.count);
+        json.beginArray("steppers");
+        for (int i = 0; i < config.deviceCount; i++)
+            config.devices[i]->writeStepMetrics(json, window * 1000000);
+        json.endArray();
+        json.endObject();
+        response->addHeader("Access-Control-Allow-Origin", "*");
+        request->send(response);
+        return;
+    }
+    pinCapture.beginExport();
+    AsyncWebServerResponse* response = request->beginChunkedResponse(
+        "text/plain",
+        [](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+            return pinCapture.read(buffer, maxLen);
+        });
+    response->addHeader("Content-Disposition", "attachment; filename=\"capture.vcd\"");
+    response->addHeader("Access-Control-Allow-Origin", "*");
+    request->send(response);
+}
+#endif
+
+// ?reset=1 restarts the step jitter statistics once they are reported,
+// so a load test can read the jitter of each run on its own
+void handleApiStats(AsyncWebServerRequest* request) {
+    HeapProbe probe(heapStats);
+    TRACE_SCOPE(TRACE_TRACK_HTTP, "/api/stats");
+    if (!admission.admit(request)) return;
+    bool resetJitter = request->hasParam("reset");
+    heapMonitor.sample();
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    JsonWriter json(response);
+    json.beginObject();
+    json.beginObject("heap")
+        .value("free", heapMonitor.freeHeap)
+        .value("maxFreeBlock", heapMonitor.maxFreeBlock)
+        .value("fragmentation", heapMonitor.fragmentation)
+        .value("minFree", heapMonitor.minFreeHeap)
+        .value("minMaxFreeBlock", heapMonitor.minMaxFreeBlock)
+        .value("maxFragmentation", heapMonitor.maxFragmentation)
+        .value("allocations", heapAllocations)
+        .endObject();
+    json.beginArray("handlers");
+    for (int i = 0; i < heapMonitor.handlerCount; i++) {
+        HandlerHeapStats* h = &heapMonitor.handlers[i];
+        json.beginObject()
+            .value("name", h->name)
+            .value("calls", h->calls)
+            .value("allocations", h->allocations)
+            .value("retained", h->retained)
+            .endObject();
+    }
+    json.endArray();
+    json.beginObject("admission")
+        .value("concurrent", admission.concurrent)
+        .value("accepted", admission.accepted)
+        .value("rateLimited", admission.rateLimited)
+        .value("shed", admission.shed)
+        .endObject();
+    json.beginObject("rate")
+        .value("rate", config.rate)
+        .value("latency", adaptiveRate.latency)
+        .value("stall", adaptiveRate.stall)
+        .endObject();
+    json.beginArray("jitter");
+    for (int i = 0; i < config.deviceCount; i++) {
+        Histogram* h = config.devices[i]->jitter();
+        if (nullptr == h) continue;
+        json.beginObject()
+            .value("name", config.devices[i]->name)
+            .value("steps", h->count)
+            .value("mean", h->mean())
+            .value("p50", h->percentile(50))
+            .value("p90", h->percentile(90))
+            .value("p99", h->percentile(99))
+            .value("max", h->max)
+            .endObject();
+        if (resetJitter) h->reset();
+    }
+    json.endArray();
+    json.beginObject("recorder")
+        .value("recorded", recorder.total)
+        .value("lost", recorder.lost)
+        .value("replaying", replayer.running)
+        .value("replayed", replayer.replayed)
+        .value("mismatched", replayer.mismatched)
+        .endObject();
+    json.beginObject("group")
+        .value("received", groupReceiver.received)
+        .value("applied", groupReceiver.applied)
+        .value("dropped", groupReceiver.dropped)
+        .value("heartbeats", groupReceiver.heartbeats)
+        .value("linksLost", groupReceiver.linksLost)
+        .endObject();
+    json.beginArray("transports");
+    Transport* transports[] = {&udpTransport, &espNowTransport};
+    for (Transport* t : transports) {
+        json.beginObject()
+            .value("name", t->name)
+            .value("sent", t->sent)
+            .value("received", t->received)
+            .value("dropped", t->dropped)
+            .endObject();
+    }
+    json.endArray();
+    json.value("mainFreeStack", stackMonitor.freeMainStack());
+    json.beginArray("tasks");
+    for (int i = 0; i < stackMonitor.taskCount; i++) {
+        json.beginObject()
+            .value("name", stackMonitor.names[i])
+            .value("freeStack", stackMonitor.freeStack(i))
+            .endObject();
+    }
+    json.endArray();
+    json.endObject();
     response->addHeader("Access-Control-Allow-Origin", "*");
     request->send(response);
 }
 
 void handleNotFound(AsyncWebServerRequest* request) {
+    HeapProbe probe(heapNotFound);
+    TRACE_SCOPE(TRACE_TRACK_HTTP, "notFound");
+    if (!admission.admit(request)) return;
     Serial.printf("[HTTP] not found: %s\n", request->url().c_str());
     if (0 == strcmp("/favicon.ico", request->url().c_str())) {
         request->send(404, "text/plain", "404 Not found");
@@ -79,14 +363,27 @@ void onStationDisconnected(const WiFiEventSoftAPModeStationDisconnected& evt) {
     Serial.println("Station disconnected");
 }
 
-class ServerTask : public Task {
+class ServerTask : public DeadlineTask {
+   public:
+    unsigned long mdnsUpdateDelay = 50;  // ms
+
    protected:
     void setup() {
         config.setServer(&server);
-        strncpy(configJson, config.toJsonString(JSON_MODE_PUBLIC).c_str(), JSON_LENGTH);
         server.on("/ui", handleWebUI);
         server.on("/api/control", handleApiControl);
         server.on("/api/config", handleApiConfig);
+        server.on("/api/log", handleApiLog);
+        server.on("/api/stats", handleApiStats);
+        server.on("/api/time", handleApiTime);
+        server.on("/api/recording", handleApiRecording);
+        server.on("/api/replay", handleApiReplay);
+#ifdef TRACE
+        server.on("/api/trace", handleApiTrace);
+#endif
+#ifdef PIN_CAPTURE
+        server.on("/api/capture", handleApiCapture);
+#endif
         server.onNotFound(handleNotFound);
         server.begin();
         if (MDNS.begin(
@@ -98,66 +395,136 @@ class ServerTask : public Task {
             Serial.println("Error setting up MDNS responder");
         }
         MDNS.addService(config.mdnsService, config.mdnsProtocol, config.apiPort);
+        addServiceTxt();
+    }
+
+    // Publish rate and device limits so clients can skip GET /api/config.
+    // Keys: v (format version), rate, lease, n (device count), d0..dN (device summary).
+    // A device summary that does not fit is left out, the client then sees
+    // fewer entries than "n" and falls back to HTTP.
+    void addServiceTxt() {
+        char key[8];
+        char value[64];
+        snprintf(value, sizeof(value), "%d", MDNS_TXT_VERSION);
+        MDNS.addServiceTxt(config.mdnsService, config.mdnsProtocol, "v", value);
+        snprintf(value, sizeof(value), "%d", config.rate);
+        MDNS.addServiceTxt(config.mdnsService, config.mdnsProtocol, "rate", value);
+        snprintf(value, sizeof(value), "%lu", config.leaseTime);
+        MDNS.addServiceTxt(config.mdnsService, config.mdnsProtocol, "lease", value);
+        snprintf(value, sizeof(value), "%d", config.deviceCount);
+        MDNS.addServiceTxt(config.mdnsService, config.mdnsProtocol, "n", value);
+        for (int i = 0; i < config.deviceCount; i++) {
+            int len = config.devices[i]->toTxt(value, sizeof(value));
+            if (len < 0 || (int)sizeof(value) <= len) {
+                LOG_W("[mDNS] TXT summary too long for device %i\n", i);
+                continue;
+            }
+            snprintf(key, sizeof(key), "d%i", i);
+            MDNS.addServiceTxt(config.mdnsService, config.mdnsProtocol, key, value);
+        }
     }
     void loop() {
+        TRACE_SCOPE(TRACE_TRACK_LOOP, "MDNS.update");
         MDNS.update();
+        sleep(mdnsUpdateDelay);
     }
 } serverTask;
 
-class MonitorTask : public Task {
+class MonitorTask : public DeadlineTask {
    public:
-    const unsigned long wdTimeout = 3600000;  // 1h
+    const unsigned long wdTimeout = 3600000;  // 1h, for remotes without heartbeats, see GroupReceiver
 
     void loop() {
+        TRACE_SCOPE(TRACE_TRACK_LOOP, "monitor");
         // Watchdog: stop stepper [wdTimeout] milliseconds after the last command received
-        unsigned int t = millis();
+        unsigned long t = millis();
         if (0 < stepper1.lastCommandTime &&
-            wdTimeout < t &&
-            stepper1.lastCommandTime < t - wdTimeout &&
+            wdTimeout < t - stepper1.lastCommandTime &&
             stepper1.setPoint != 0) {
-            Serial.printf("[Watchdog] Remote timed out, stopping the stepper\n");
-            stepper1.setPoint = 0;
+            LOG_W("[Watchdog] Remote timed out, stopping the stepper\n");
+            stepper1.stop();
             stepper1.lastCommandTime = t;
         }
 
         // Log monitor messages to the serial console
         IPAddress ip = WiFi.getMode() == WIFI_AP ? WiFi.softAPIP() : WiFi.localIP();
-        Serial.printf(
-            "[Monitor] IP: %s  WD: %ld EN: %d  DI: %d  SP: %d(%d)\n",
-            ip.toString().c_str(),
+        LOG_I(
+            "[Monitor] IP: %d.%d.%d.%d  WD: %ld EN: %d  DI: %d  SP: %d(%d)  IDLE: %d%%\n",
+            ip[0], ip[1], ip[2], ip[3],
             0 == stepper1.setPoint ? 0 : (wdTimeout - (millis() - stepper1.lastCommandTime)) / 1000,
             stepper1.command == 0 ? 0 : 1,
             stepper1.command > 0 ? 1 : 0,
             abs(stepper1.command),
-            abs(stepper1.setPoint));
+            abs(stepper1.setPoint),
+            idleTask.idlePercent);
+        heapMonitor.sample();
+        LOG_I("[Monitor] Heap free: %u (min %u)  max block: %u (min %u)  fragmentation: %u%% (max %u%%)  allocations: %u\n",
+              heapMonitor.freeHeap,
+              heapMonitor.minFreeHeap,
+              heapMonitor.maxFreeBlock,
+              heapMonitor.minMaxFreeBlock,
+              heapMonitor.fragmentation,
+              heapMonitor.maxFragmentation,
+              heapAllocations);
+        LOG_I("[Monitor] Free stack main: %d\n", stackMonitor.freeMainStack());
+        for (int i = 0; i < stackMonitor.taskCount; i++) {
+            LOG_I("[Monitor] Free stack %s: %d\n", stackMonitor.names[i], stackMonitor.freeStack(i));
+        }
 
-        delay(5000);
+        sleep(5000);
     }
 } monitorTask;
 
 void setup() {
     config.name = NAME;                 // server name
-    config.rate = 200;                  // minimum number of milliseconds between commands sent by the client
+    config.rate = 200;                  // initial number of milliseconds between commands sent by the client
     config.mdnsService = MDNS_SERVICE;  // clients look for this service when discovering
     config.apiPort = API_PORT;
+    config.leaseTime = 5000;            // a controller owns a device until this many ms after its last command
 
     stepper1.name = "Stepper1";
-    stepper1.pinEnable = D1;
-    stepper1.pinDirection = D2;
-    stepper1.pinPulse = D3;
     stepper1.pulseMin = 200;    // minimum pause between pulses in microsecs (fastest speed)
     stepper1.pulseMax = 15000;  // maximum pause between pulses in microsecs (slowest speed)
     stepper1.pulseWidth = 1;    // pulse width in microsecs
     stepper1.changeMax = 100;   // maximum step of speed change per cycle
     stepper1.commandMin = -1024;
     stepper1.commandMax = 1024;
+    stepper1.group = "steppers";  // also follows commands multicast to this group
 
     config.addDevice(&stepper1);
+    stackMonitor.add(stepper1.name, &stepper1);
+
+    admission.setRate(config.rate, config.deviceCount);  // one command per device per rate
+    adaptiveRate.setConfig(&config);
+    groupReceiver.setConfig(&config);
+    config.recorder = &recorder;
+    // recorder.persist = true;  // also keep the commands on LittleFS, see recorder.h
+    replayer.setConfig(&config);
+    groupReceiver.addTransport(&udpTransport);
+    groupReceiver.addTransport(&espNowTransport);
+    adaptiveRate.rateMin = 50;    // fastest command interval offered when idle
+    adaptiveRate.rateMax = 1000;  // slowest command interval asked for under load
 
     pinMode(LED_BUILTIN, OUTPUT);
     digitalWrite(LED_BUILTIN, LOW);
     Serial.begin(115200);
 
+#ifdef BENCHMARK
+    static Stepper stepperRuntime("Runtime", D1, D2, D3);  // a Task holds its own stack, too big for setup()'s
+    Serial.printf("[Benchmark] Stepper max step rate: %lu steps/s\n", stepperRuntime.benchmark());
+#ifndef I2S_STEPPER
+    Serial.printf("[Benchmark] FastStepper max step rate: %lu steps/s\n", stepper1.benchmark());
+#endif
+    Bench bench;
+    NullPrint nullPrint;
+    stepper1.benchmarkCalls(bench);
+    bench.run("Config::device(name)", 1000, []() { config.device("Stepper1"); });
+    bench.run("Config::writeJson", 100, [&nullPrint]() {
+        JsonWriter json(&nullPrint);
+        config.writeJson(json, JSON_MODE_PUBLIC);
+    });
+#endif
+
     connectedHandler = WiFi.onStationModeConnected(&onConnected);
     disconnectedHandler = WiFi.onStationModeDisconnected(&onDisconnected);
     softAPStationConnectedHandler = WiFi.onSoftAPModeStationConnected(&onStationConnected);
@@ -181,9 +548,15 @@ void setup() {
     // Serial.print(" connected, IP: ");
     // Serial.println(WiFi.localIP());
 
+    Scheduler.start(&logTask);
     Scheduler.start(&serverTask);
     config.startControlTasks();
     Scheduler.start(&monitorTask);
+    Scheduler.start(&adaptiveRate);
+    Scheduler.start(&groupReceiver);
+    Scheduler.start(&recorder);
+    Scheduler.start(&replayer);
+    Scheduler.start(&idleTask);
     Scheduler.begin();
 }
 
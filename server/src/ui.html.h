@@ -147,6 +147,11 @@ const char indexHtmlTemplate[] PROGMEM = R"====(
                         console.log("Unknown device type: " + types[device]);
                 }
                 console.log(url);
+                req.onload = function () {
+                    // the server adapts the rate to its load
+                    var serverRate = parseInt(req.getResponseHeader("X-Rate"));
+                    if (0 < serverRate) rate = serverRate;
+                };
                 req.open("GET", url, true);
                 req.send();
                 lastCommands[device] = now;
@@ -0,0 +1,72 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include <stdint.h>
+
+// Renders a step pulse train into 32-bit words, one bit per tick, MSB first,
+// for streaming out of a serial peripheral (I2S DMA). The phase carries over
+// between calls, so consecutive buffers form one continuous signal.
+// Does not depend on the Arduino core.
+class StepWaveform {
+   public:
+    uint32_t period = 0;      // ticks from pulse start to pulse start, 0: stopped
+    uint32_t pulseWidth = 1;  // ticks
+    uint32_t pulses = 0;      // number of pulses started so far
+
+    // Fills [count] words and returns the number of pulses started in them
+    uint32_t render(uint32_t *words, int count) {
+        uint32_t started = pulses;
+        int word = 0;
+        int bit = 32;  // free bits left in words[word]
+        words[0] = 0;
+        while (word < count) {
+            bool high;
+            uint32_t run;
+            if (phase < pulseWidth) {
+                high = true;
+                run = pulseWidth - phase;
+            } else if (0 == period) {
+                high = false;
+                run = UINT32_MAX;
+            } else if (period <= phase) {
+                phase = 0;
+                pulses++;
+                continue;
+            } else {
+                high = false;
+                run = period - phase;
+            }
+            // write [run] bits of [high], or until the buffer is full
+            while (0 < run && word < count) {
+                uint32_t n = run < (uint32_t)bit ? run : bit;
+                if (high) {
+                    uint32_t mask = 32 == n ? UINT32_MAX : ((1u << n) - 1) << (bit - n);
+                    words[word] |= mask;
+                }
+                bit -= n;
+                run -= n;
+                advance(n);
+                if (0 == bit) {
+                    word++;
+                    bit = 32;
+                    if (word < count) words[word] = 0;
+                }
+            }
+        }
+        return pulses - started;
+    }
+
+    // Starts the next pulse on the next tick
+    void restart() {
+        phase = 0 == period ? UINT32_MAX : period;
+    }
+
+   protected:
+    uint32_t phase = UINT32_MAX;  // ticks since the last pulse start, saturates while stopped
+
+    void advance(uint32_t ticks) {
+        phase = UINT32_MAX - phase < ticks ? UINT32_MAX : phase + ticks;
+    }
+};
+
+#endif
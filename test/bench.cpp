@@ -0,0 +1,81 @@
+// The firmware's microbenchmarks on the host: make -C test bench
+//
+// Same JSON lines as the BENCHMARK build prints on the serial console.
+// The host clock stands in for the cycle counter of a 1000 MHz CPU, so
+// "cycles" reads as ns per call. Absolute figures say little about the
+// ESP; compare them between revisions of the code on the same machine.
+// The steppers' max step rate is left out: on the host the pins and delays
+// are fakes that cost nothing, so it only times the loop around them.
+#include <mallocnew.h>
+
+#include <remotecommand.h>
+
+#include "config.h"
+
+class StdoutPrint : public Print {
+   public:
+    using Print::write;
+    size_t write(const uint8_t *buffer, size_t size) override {
+        return fwrite(buffer, 1, size, stdout);
+    }
+};
+
+int main() {
+    StdoutPrint out;
+    Config config;
+    FastStepper<D1, D2, D3> stepper1;
+    stepper1.name = "Stepper1";
+    stepper1.commandMin = -1024;
+    stepper1.commandMax = 1024;
+    stepper1.group = "steppers";
+    config.addDevice(&stepper1);
+
+    Bench bench;
+    bench.out = &out;
+    NullPrint nullPrint;
+    stepper1.benchmarkCalls(bench);
+    bench.run("Config::device(name)", 1000, [&config]() { config.device("Stepper1"); });
+    bench.run("Config::writeJson", 100, [&config, &nullPrint]() {
+        JsonWriter json(&nullPrint);
+        config.writeJson(json, JSON_MODE_PUBLIC);
+    });
+    char message[100];
+    bench.run("Config::control", 1000, [&config, &message]() {
+        const char *pairs[] = {"device", "Stepper1", "command", "300", "slew", "20"};
+        ControlArgs args(pairs, 3, 1);
+        config.control(args, message, sizeof(message));
+    });
+
+    // the remote's side, see lib/RemoteCommand; the inputs change every
+    // call, so the compiler cannot hoist the work out of the loop
+    int readings[64];
+    for (int i = 0; i < 64; i++)
+        readings[i] = 500 + i % 7;
+    int value = 0;
+    bench.run("Pot::read averaging", 1000, [&readings, &value]() {
+        long total = 0;
+        for (int i = 0; i < 64; i++)
+            total += readings[i];
+        readings[value % 64]++;
+        value = averageReading(total, 64, 0, 1024);
+    });
+    int command = 0;
+    bench.run("Pot::calculateCommand", 1000, [&value, &command]() {
+        value = (value + 37) % 1025;
+        command = potCommand(value, 0, 1024, -1024, 1024);
+    });
+    bench.run("PotWithDirectionAndEnableCommandTask::calculateCommand", 1000, [&value, &command]() {
+        value = (value + 37) % 1025;
+        command = potDirectionCommand(value, 0, 1024, true, true, value & 1, -1024, 1024);
+    });
+    char path[128];
+    bench.run("Device::commandPath", 1000, [&path, &command]() {
+        formatCommandPath(path, sizeof(path), "Stepper1", command, 200, 4000000000u, "00c0ffee", 0);
+    });
+    bench.run("Config::configFromTxt parsing", 100, []() {
+        char txts[] = "v=1;rate=200;lease=5000;n=2;d0=Stepper1,stepper,-1024,1024;d1=Led,led";
+        TxtConfig conf;
+        parseTxtConfig(txts, conf);
+    });
+    return command == value;  // keeps the results, 0 unless they happen to match
+}
@@ -0,0 +1,22 @@
+#ifndef ABSTRACTTASK_H
+#define ABSTRACTTASK_H
+
+#include <Arduino.h>
+
+class AbstractTask {
+    friend class SchedulerClass;
+
+   public:
+    AbstractTask() {}
+    virtual ~AbstractTask() {}
+
+   protected:
+    virtual void setup() {}
+    virtual void loop() {}
+    virtual bool shouldRun() { return true; }
+
+   private:
+    bool setupDone = false;
+};
+
+#endif
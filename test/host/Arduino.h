@@ -0,0 +1,298 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+// The parts of the ESP8266 Arduino core the shared headers use, enough to
+// run them on the host. Time only moves when a test moves it, through
+// delay(), delayMicroseconds() or hostNanos, except for the small steps
+// busy-waits need to finish: yield() takes 1 us, a cycle count read 1 ns.
+// With -DHOST_REAL_TIME the clock is the host's steady clock instead, for
+// benchmarks.
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define PROGMEM
+#define F(x) x
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+#define INPUT_PULLUP 2
+#define CHANGE 3
+#define D1 5
+#define D2 4
+#define D3 0
+#define D5 14
+#define D6 12
+#define A0 17
+#define LED_BUILTIN 2
+
+typedef uint8_t byte;
+
+using std::max;
+using std::min;
+
+template <class T>
+T constrain(T value, T low, T high) {
+    return value < low ? low : high < value ? high : value;
+}
+
+#ifdef HOST_REAL_TIME
+inline uint64_t hostNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+inline void hostAdvance(uint64_t) {}
+#else
+inline uint64_t hostNanos = 0;  // the fake clock, ns since boot
+
+inline uint64_t hostNow() {
+    return hostNanos;
+}
+inline void hostAdvance(uint64_t ns) {
+    hostNanos += ns;
+}
+#endif
+
+inline unsigned long millis() {
+    return hostNow() / 1000000;
+}
+inline unsigned long micros() {
+    return (uint32_t)(hostNow() / 1000);
+}
+inline uint64_t micros64() {
+    return hostNow() / 1000;
+}
+inline void delay(unsigned long ms) {
+    hostAdvance((uint64_t)ms * 1000000);
+}
+inline void delayMicroseconds(unsigned int us) {
+    hostAdvance((uint64_t)us * 1000);
+}
+// Runs in every yield(), so a test can act inside a busy-wait, e.g. end a step loop
+inline std::function<void()> hostYield;
+
+inline void yield() {
+    hostAdvance(1000);
+    if (hostYield) hostYield();
+}
+
+// Pins keep the last level written
+inline uint8_t hostPins[32];
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t pin, uint8_t level) {
+    hostPins[pin % 32] = level;
+}
+inline int digitalRead(uint8_t pin) {
+    return hostPins[pin % 32];
+}
+inline int analogRead(uint8_t) {
+    return 0;
+}
+inline int digitalPinToInterrupt(int pin) {
+    return pin;
+}
+inline void attachInterrupt(int, void (*)(), int) {}
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+inline volatile uint32_t GPOS;  // written bits go high
+inline volatile uint32_t GPOC;  // written bits go low
+inline volatile uint32_t GPI;
+
+#define interrupts()
+#define noInterrupts()
+extern "C" inline uint32_t xt_rsil(uint32_t) {
+    return 0;
+}
+extern "C" inline void xt_wsr_ps(uint32_t) {}
+
+class String {
+   public:
+    std::string s;
+
+    String() {}
+    String(const char *c) : s(c ? c : "") {}
+    String(int i) : s(std::to_string(i)) {}
+    String(unsigned int i) : s(std::to_string(i)) {}
+    String(long i) : s(std::to_string(i)) {}
+    String(unsigned long i) : s(std::to_string(i)) {}
+    const char *c_str() const { return s.c_str(); }
+    long toInt() const { return atol(s.c_str()); }
+    unsigned int length() const { return s.size(); }
+    bool operator==(const char *o) const { return s == o; }
+    bool operator==(const String &o) const { return s == o.s; }
+    String &operator+=(const String &o) {
+        s += o.s;
+        return *this;
+    }
+    String &operator+=(const char *o) {
+        s += o;
+        return *this;
+    }
+    String &operator+=(char o) {
+        s += o;
+        return *this;
+    }
+    bool reserve(unsigned int n) {
+        s.reserve(n);
+        return true;
+    }
+    char operator[](unsigned int i) const { return s[i]; }
+};
+
+inline String operator+(const String &a, const String &b) {
+    String r = a;
+    r += b;
+    return r;
+}
+
+class Print {
+   public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) {
+        return write(&c, 1);
+    }
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (n < size && 1 == write(buffer[n])) n++;
+        return n;
+    }
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t write(const char *s, size_t n) { return write((const uint8_t *)s, n); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[256];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        if (len < 0) return 0;
+        if ((size_t)len < sizeof(buf)) return write((const uint8_t *)buf, len);
+        std::string big(len + 1, '\0');
+        va_start(args, format);
+        vsnprintf(&big[0], big.size(), format, args);
+        va_end(args);
+        return write((const uint8_t *)big.data(), len);
+    }
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int i) { return printf("%d", i); }
+    size_t println(const char *s = "") { return print(s) + print("\r\n"); }
+    size_t println(const String &s) { return println(s.c_str()); }
+    size_t println(int i) { return print(i) + print("\r\n"); }
+};
+
+class Stream : public Print {
+   public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    size_t readBytes(char *, size_t) { return 0; }
+    size_t readBytes(uint8_t *, size_t) { return 0; }
+    void setTimeout(unsigned long) {}
+};
+
+// Keeps what is written in [output]. [writable] is the free space of the
+// FIFO it stands for, negative for unlimited. Where the ESP would wait for
+// the FIFO to drain, the bytes are taken all the same and counted in
+// [blocked].
+class HardwareSerial : public Stream {
+   public:
+    std::string output;
+    int fifoSize = 128;
+    int writable = -1;
+    size_t blocked = 0;
+
+    void begin(int) {}
+
+    using Print::write;
+    size_t write(const uint8_t *buffer, size_t size) override {
+        output.append((const char *)buffer, size);
+        if (writable < 0) return size;
+        if ((size_t)writable < size) blocked += size - writable;
+        writable = (size_t)writable < size ? 0 : writable - size;
+        return size;
+    }
+    int availableForWrite() override {
+        return writable < 0 ? fifoSize : writable;
+    }
+};
+
+inline HardwareSerial Serial;
+
+class IPAddress : public Print {
+   public:
+    uint8_t b[4] = {0};
+
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t c, uint8_t d, uint8_t e) {
+        b[0] = a;
+        b[1] = c;
+        b[2] = d;
+        b[3] = e;
+    }
+    IPAddress(uint32_t v) { memcpy(b, &v, 4); }
+    String toString() const {
+        char s[16];
+        snprintf(s, sizeof(s), "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+        return String(s);
+    }
+    operator uint32_t() const {
+        uint32_t v;
+        memcpy(&v, b, 4);
+        return v;
+    }
+    bool operator==(const IPAddress &o) const { return 0 == memcmp(b, o.b, 4); }
+    bool operator!=(const IPAddress &o) const { return !(*this == o); }
+    uint8_t operator[](int i) const { return b[i]; }
+    uint8_t &operator[](int i) { return b[i]; }
+    bool isSet() const { return 0 != (uint32_t) * this; }
+};
+
+// A CPU at 1000 MHz, so a cycle is a ns of the clock above
+class EspClass {
+   public:
+    uint32_t freeHeap = 40000;
+    uint32_t maxFreeBlock = 30000;
+    uint8_t fragmentation = 10;
+    uint32_t freeContStack = 2000;
+
+    uint32_t getFreeHeap() { return freeHeap; }
+    uint8_t getHeapFragmentation() { return fragmentation; }
+    uint32_t getMaxFreeBlockSize() { return maxFreeBlock; }
+    uint32_t getCycleCount() {
+        hostAdvance(1);
+        return (uint32_t)hostNow();
+    }
+    uint32_t getCpuFreqMHz() { return 1000; }
+    uint32_t getChipId() { return 0x00c0ffee; }
+    uint32_t random() { return ::random(); }
+    uint32_t getFreeContStack() { return freeContStack; }
+    void getHeapStats(uint32_t *free, uint16_t *max, uint8_t *frag) {
+        if (free) *free = freeHeap;
+        if (max) *max = maxFreeBlock;
+        if (frag) *frag = fragmentation;
+    }
+    void restart() {}
+};
+
+inline EspClass ESP;
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef ESPASYNCWEBSERVER_H
+#define ESPASYNCWEBSERVER_H
+
+// Requests a test builds by hand: parameters, a remote address, and the
+// code and headers of the response they were answered with
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#include <map>
+#include <vector>
+
+class AsyncWebParameter {
+   public:
+    String paramName;
+    String paramValue;
+
+    AsyncWebParameter(const char *name, const char *value) : paramName(name), paramValue(value) {}
+    const String &name() const { return paramName; }
+    const String &value() const { return paramValue; }
+    bool isPost() const { return false; }
+};
+
+class AsyncClient {
+   public:
+    IPAddress ip;
+
+    IPAddress remoteIP() { return ip; }
+    uint16_t remotePort() { return 0; }
+};
+
+class AsyncWebServerResponse {
+   public:
+    int code = 0;
+    String body;
+    std::map<std::string, std::string> headers;
+
+    virtual ~AsyncWebServerResponse() {}
+    void addHeader(const String &name, const String &value) { headers[name.s] = value.s; }
+    void setCode(int code) { this->code = code; }
+};
+
+class AsyncResponseStream : public AsyncWebServerResponse, public Print {
+   public:
+    using Print::write;
+    size_t write(const uint8_t *buffer, size_t size) override {
+        body.s.append((const char *)buffer, size);
+        return size;
+    }
+};
+
+typedef std::function<String(const String &)> AwsTemplateProcessor;
+typedef std::function<size_t(uint8_t *, size_t, size_t)> AwsResponseFiller;
+enum WebRequestMethod { HTTP_GET = 1,
+                        HTTP_POST = 2,
+                        HTTP_ANY = 127 };
+typedef int WebRequestMethodComposite;
+
+class AsyncWebServerRequest {
+   public:
+    AsyncClient remote;
+    std::vector<AsyncWebParameter> parameters;
+    AsyncWebServerResponse *response = nullptr;  // the last one sent
+    std::function<void(void)> disconnected;
+
+    AsyncWebServerRequest(IPAddress ip = IPAddress(192, 168, 4, 2)) { remote.ip = ip; }
+    ~AsyncWebServerRequest() { delete response; }
+
+    AsyncWebServerRequest &param(const char *name, const char *value) {
+        parameters.emplace_back(name, value);
+        return *this;
+    }
+    int code() const { return nullptr == response ? 0 : response->code; }
+    void disconnect() {
+        if (disconnected) disconnected();
+        disconnected = nullptr;
+    }
+
+    AsyncClient *client() { return &remote; }
+    size_t params() const { return parameters.size(); }
+    AsyncWebParameter *getParam(size_t i) { return &parameters[i]; }
+    AsyncWebParameter *getParam(const char *name, bool = false, bool = false) {
+        for (AsyncWebParameter &p : parameters)
+            if (p.name() == name) return &p;
+        return nullptr;
+    }
+    bool hasParam(const char *name, bool = false, bool = false) { return nullptr != getParam(name); }
+    bool hasArg(const char *name) { return hasParam(name); }
+    const String &arg(const char *name) {
+        static String none;
+        AsyncWebParameter *p = getParam(name);
+        return nullptr == p ? none : p->value();
+    }
+    const String &arg(const String &name) { return arg(name.c_str()); }
+    const String &url() const {
+        static String s;
+        return s;
+    }
+    WebRequestMethodComposite method() const { return HTTP_GET; }
+
+    AsyncWebServerResponse *beginResponse(int code, const String & = String(), const String &body = String()) {
+        AsyncWebServerResponse *r = new AsyncWebServerResponse();
+        r->code = code;
+        r->body = body;
+        return r;
+    }
+    AsyncWebServerResponse *beginResponse_P(int code, const String &type, const char *body, AwsTemplateProcessor = nullptr) {
+        return beginResponse(code, type, String(body));
+    }
+    AsyncWebServerResponse *beginResponse(const String &, size_t, AwsResponseFiller, AwsTemplateProcessor = nullptr) {
+        return beginResponse(200);
+    }
+    AsyncWebServerResponse *beginChunkedResponse(const String &, AwsResponseFiller, AwsTemplateProcessor = nullptr) {
+        return beginResponse(200);
+    }
+    AsyncResponseStream *beginResponseStream(const String &, size_t = 1460) {
+        AsyncResponseStream *r = new AsyncResponseStream();
+        r->code = 200;
+        return r;
+    }
+    void send(AsyncWebServerResponse *r) {
+        delete response;
+        response = r;
+    }
+    void send(int code, const String &type = String(), const String &body = String()) {
+        send(beginResponse(code, type, body));
+    }
+    void send(fs::FS &, const String &, const String & = String(), bool = false) { send(200); }
+    void send(int code, const String &, size_t, AwsResponseFiller) { send(code); }
+    void onDisconnect(std::function<void(void)> callback) { disconnected = callback; }
+};
+
+typedef std::function<void(AsyncWebServerRequest *)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *, uint8_t *, size_t, size_t, size_t)> ArBodyHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *, const String &, size_t, uint8_t *, size_t, bool)> ArUploadHandlerFunction;
+
+class AsyncCallbackWebHandler {};
+
+class AsyncWebServer {
+   public:
+    AsyncWebServer(uint16_t) {}
+    AsyncCallbackWebHandler &on(const char *, ArRequestHandlerFunction) { return handler; }
+    AsyncCallbackWebHandler &on(const char *, WebRequestMethodComposite, ArRequestHandlerFunction) { return handler; }
+    AsyncCallbackWebHandler &on(const char *, WebRequestMethodComposite, ArRequestHandlerFunction, ArUploadHandlerFunction, ArBodyHandlerFunction) { return handler; }
+    void onNotFound(ArRequestHandlerFunction) {}
+    void begin() {}
+
+   private:
+    AsyncCallbackWebHandler handler;
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef LEANTASK_H
+#define LEANTASK_H
+
+#include "AbstractTask.h"
+
+class LeanTask : public AbstractTask {
+   public:
+    LeanTask() {}
+
+   protected:
+    bool shouldRun() { return true; }
+};
+
+#endif
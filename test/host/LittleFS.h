@@ -0,0 +1,79 @@
+#ifndef LITTLEFS_H
+#define LITTLEFS_H
+
+// A file system in memory, files are strings shared by their open handles
+#include <Arduino.h>
+
+#include <map>
+#include <memory>
+
+class File : public Stream {
+   public:
+    File() {}
+    File(std::shared_ptr<std::string> data, size_t position) : data(data), offset(position) {}
+
+    operator bool() const { return nullptr != data; }
+
+    using Print::write;
+    size_t write(const uint8_t *buffer, size_t size) override {
+        if (nullptr == data) return 0;
+        data->replace(offset, std::min(size, data->size() - offset), (const char *)buffer, size);
+        offset += size;
+        return size;
+    }
+    size_t read(uint8_t *buffer, size_t size) {
+        if (nullptr == data || data->size() <= offset) return 0;
+        size = std::min(size, data->size() - offset);
+        memcpy(buffer, data->data() + offset, size);
+        offset += size;
+        return size;
+    }
+    int read() override {
+        uint8_t c;
+        return 1 == read(&c, 1) ? c : -1;
+    }
+    int available() override { return nullptr == data ? 0 : data->size() - offset; }
+    size_t size() const { return nullptr == data ? 0 : data->size(); }
+    size_t position() const { return offset; }
+    bool seek(uint32_t position) {
+        if (nullptr == data || data->size() < position) return false;
+        offset = position;
+        return true;
+    }
+    void close() { data = nullptr; }
+
+   private:
+    std::shared_ptr<std::string> data;
+    size_t offset = 0;
+};
+
+namespace fs {
+class FS {
+   public:
+    std::map<std::string, std::shared_ptr<std::string>> files;
+
+    bool begin() { return true; }
+    File open(const char *path, const char *mode) {
+        auto found = files.find(path);
+        if ('r' == *mode) return files.end() == found ? File() : File(found->second, 0);
+        if (files.end() == found || 'w' == *mode)
+            files[path] = std::make_shared<std::string>();
+        std::shared_ptr<std::string> data = files[path];
+        return File(data, 'a' == *mode ? data->size() : 0);
+    }
+    bool exists(const char *path) { return files.count(path); }
+    bool remove(const char *path) { return files.erase(path); }
+    bool rename(const char *from, const char *to) {
+        auto found = files.find(from);
+        if (files.end() == found) return false;
+        files[to] = found->second;
+        files.erase(found);
+        return true;
+    }
+};
+}  // namespace fs
+using fs::FS;
+
+inline FS LittleFS;
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+// Runs the started tasks when a test asks for it: run() is one pass of the
+// ESP scheduler, every task that should run loops once, in start order
+#include <vector>
+
+#include "LeanTask.h"
+#include "Task.h"
+
+class SchedulerClass {
+   public:
+    std::vector<AbstractTask *> tasks;
+
+    void start(AbstractTask *task) { tasks.push_back(task); }
+    void begin() {}
+
+    void run() {
+        for (AbstractTask *task : tasks)
+            run(task);
+    }
+
+    // One pass of a single task, started or not
+    static void run(AbstractTask *task) {
+        if (!task->setupDone) {
+            task->setupDone = true;
+            task->setup();
+        }
+        if (task->shouldRun()) task->loop();
+    }
+};
+
+inline SchedulerClass Scheduler;
+
+#endif
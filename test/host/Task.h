@@ -0,0 +1,39 @@
+#ifndef TASK_H
+#define TASK_H
+
+// A task with its own stack on the ESP. On the host nothing switches
+// stacks: a test calls setup() and loop() itself, delay() moves the clock.
+// A simulation sets hostTaskWait to run the other tasks meanwhile, see
+// simulation.h.
+#include <functional>
+
+#include "AbstractTask.h"
+#include <cont.h>
+
+// Waits [ms] in a Task, 0 for a yield()
+inline std::function<void(unsigned long)> hostTaskWait;
+
+class Task : public AbstractTask {
+   public:
+    Task() {}
+
+   protected:
+    void delay(unsigned long ms) {
+        if (hostTaskWait)
+            hostTaskWait(ms);
+        else
+            ::delay(ms);
+    }
+    void yield() {
+        if (hostTaskWait)
+            hostTaskWait(0);
+        else
+            ::yield();
+    }
+    bool shouldRun() { return true; }
+
+   private:
+    cont_t context;
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef CONT_H
+#define CONT_H
+
+#define CONT_STACKGUARD 0xfeefeffe
+#define CONT_STACKSIZE 4096
+
+typedef struct cont_ {
+    unsigned stack_guard1;
+    unsigned stack[CONT_STACKSIZE / 4];
+    unsigned stack_guard2;
+} cont_t;
+
+#endif
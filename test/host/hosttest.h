@@ -0,0 +1,73 @@
+#ifndef HOSTTEST_H
+#define HOSTTEST_H
+
+#include <stdio.h>
+
+// Minimal test runner for the host tests, one binary per test file:
+//     TEST(rendersPulses) {
+//         CHECK_EQ(3, waveform.render(words, 4));
+//     }
+// A failed check ends its test, main() runs them all and returns the
+// number that failed.
+#define HOSTTEST_MAX_TESTS 64
+
+struct HostTest {
+    const char *name;
+    void (*run)();
+};
+
+HostTest hostTests[HOSTTEST_MAX_TESTS];
+int hostTestCount = 0;
+bool hostTestFailed = false;
+
+struct HostTestRegistrar {
+    HostTestRegistrar(const char *name, void (*run)()) {
+        if (HOSTTEST_MAX_TESTS <= hostTestCount) return;
+        hostTests[hostTestCount++] = {name, run};
+    }
+};
+
+void hostTestFail(const char *file, int line, const char *check) {
+    printf("    %s:%d: %s\n", file, line, check);
+    hostTestFailed = true;
+}
+
+#define TEST(name)                                     \
+    static void name();                                \
+    static HostTestRegistrar name##Registrar(#name, name); \
+    static void name()
+
+#define CHECK(condition)                                  \
+    do {                                                  \
+        if (!(condition)) {                               \
+            hostTestFail(__FILE__, __LINE__, #condition); \
+            return;                                       \
+        }                                                 \
+    } while (0)
+
+#define CHECK_EQ(expected, actual)                                             \
+    do {                                                                       \
+        long long checkExpected = (long long)(expected);                       \
+        long long checkActual = (long long)(actual);                           \
+        if (checkExpected != checkActual) {                                    \
+            char check[160];                                                   \
+            snprintf(check, sizeof(check), "%s == %s: %lld != %lld",           \
+                     #expected, #actual, checkExpected, checkActual);          \
+            hostTestFail(__FILE__, __LINE__, check);                           \
+            return;                                                            \
+        }                                                                      \
+    } while (0)
+
+int main() {
+    int failed = 0;
+    for (int i = 0; i < hostTestCount; i++) {
+        hostTestFailed = false;
+        hostTests[i].run();
+        printf("[Test] %s %s\n", hostTests[i].name, hostTestFailed ? "FAILED" : "ok");
+        if (hostTestFailed) failed++;
+    }
+    printf("[Test] %d of %d failed\n", failed, hostTestCount);
+    return failed;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef MALLOCNEW_H
+#define MALLOCNEW_H
+
+// On the ESP, new is malloc. Here libstdc++ calls its own malloc, out of
+// reach of -Wl,--wrap=malloc; routing new through the wrapped one counts
+// C++ allocations in heapAllocations too. Include in one file per binary.
+#include <stdlib.h>
+
+#include <new>
+
+void *operator new(size_t size) {
+    void *p = malloc(size);
+    if (nullptr == p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+// Discrete-event simulation of the ESP scheduler on the fake clock. Nothing
+// waits: when no task is due the clock jumps to the next deadline, the
+// earliest DeadlineTask wakeup, Task delay or event, so days of firmware
+// time run in seconds and the same way on every run.
+//     Simulation sim;
+//     sim.add(&stepper);
+//     sim.add(&recorder);
+//     sim.at(hours(1), []() { ... });
+//     sim.run(days(2));
+// Tasks run in the order they were added, like started ones on the ESP. A
+// Task with its own stack runs its loop() on the host stack, and its yield()
+// and delay() run the events and the LeanTasks meanwhile, as the ESP
+// scheduler does while it is switched out. Only one Task at a time can be
+// inside loop(): a second one runs once the first returns, so simulate one
+// stepping motor per run. A Task still inside loop() when the run ends is
+// unwound there, the next run() starts its loop() over.
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include <Arduino.h>
+#include <LeanTask.h>
+#include <Scheduler.h>
+#include <Task.h>
+#include <tickless.h>
+
+inline uint64_t seconds(uint64_t s) {
+    return s * 1000000000ull;
+}
+inline uint64_t hours(uint64_t h) {
+    return seconds(h * 3600);
+}
+inline uint64_t days(uint64_t d) {
+    return hours(d * 24);
+}
+
+class Simulation {
+   public:
+    uint64_t events = 0;  // run so far
+    uint64_t passes = 0;  // scheduler passes so far
+    uint64_t jumps = 0;   // times the clock skipped ahead to a deadline
+
+    void add(AbstractTask *task) {
+        bool stack = nullptr != dynamic_cast<Task *>(task);
+        tasks.push_back({task, stack, dynamic_cast<DeadlineTask *>(task)});
+        if (stack) stackTasks++;
+    }
+
+    // Runs [action] once the clock reaches [time], ns since boot
+    void at(uint64_t time, std::function<void()> action) {
+        queue.push({time, sequence++, action});
+    }
+
+    // Runs [action] every [period] ns from now on
+    void every(uint64_t period, std::function<void()> action) {
+        at(hostNanos + period, [this, period, action]() {
+            action();
+            every(period, action);
+        });
+    }
+
+    // Runs the tasks and events for [duration] ns
+    void run(uint64_t duration) {
+        end = hostNanos + duration;
+        hostTaskWait = [this](unsigned long ms) { wait(ms); };
+        while (hostNanos < end) {
+            try {
+                pass(false);
+            } catch (RunEnd &) {
+                inTask = false;
+                break;
+            }
+            if (0 < stackTasks)
+                hostAdvance(1000);  // a Task loops again at once, its delay() moves the clock
+            else
+                advance(end);
+        }
+        hostTaskWait = nullptr;
+    }
+
+   protected:
+    struct Event {
+        uint64_t time;
+        uint64_t sequence;  // keeps events at the same time in the order they were added
+        std::function<void()> action;
+
+        bool operator<(const Event &other) const {
+            return time != other.time ? other.time < time : other.sequence < sequence;
+        }
+    };
+
+    struct Entry {
+        AbstractTask *task;
+        bool stack;              // a Task, with its own stack on the ESP
+        DeadlineTask *deadline;  // nullptr for other tasks
+    };
+
+    std::vector<Entry> tasks;
+    int stackTasks = 0;
+    std::priority_queue<Event> queue;
+    uint64_t sequence = 0;
+    bool inTask = false;  // a Task is inside loop()
+    uint64_t end = 0;     // ns, of the current run
+
+    struct RunEnd {};  // unwinds a Task from wait() at the end of a run
+
+    // One scheduler pass: the events that are due, then every task once, or
+    // only the LeanTasks while a Task waits
+    void pass(bool leanOnly) {
+        passes++;
+        while (!queue.empty() && queue.top().time <= hostNanos) {
+            Event event = queue.top();
+            queue.pop();
+            events++;
+            event.action();
+        }
+        for (Entry &entry : tasks) {
+            if (entry.stack && (leanOnly || inTask)) continue;
+            inTask = entry.stack;
+            SchedulerClass::run(entry.task);
+            inTask = false;
+        }
+    }
+
+    // Moves the clock to the next event or DeadlineTask wakeup, at most to
+    // [limit], or by 1 us if a task is due now
+    void advance(uint64_t limit) {
+        uint64_t next = limit;
+        if (!queue.empty() && queue.top().time < next) next = queue.top().time;
+        unsigned long now = millis();
+        for (Entry &entry : tasks) {
+            if (entry.stack) continue;
+            if (nullptr == entry.deadline || entry.deadline->due(now)) {
+                next = hostNanos;
+                break;
+            }
+            uint64_t wake = (uint64_t)entry.deadline->wakeTime * 1000000;
+            if (wake < next) next = wake;
+        }
+        if (next <= hostNanos) {
+            hostAdvance(1000);
+            return;
+        }
+        hostNanos = next;
+        jumps++;
+    }
+
+    // A Task yields, [ms] 0, or sleeps: the LeanTasks and events go on
+    void wait(unsigned long ms) {
+        if (0 == ms) {
+            ::yield();
+            pass(true);
+        } else {
+            uint64_t wake = std::min(hostNanos + (uint64_t)ms * 1000000, end);
+            while (hostNanos < wake) {
+                pass(true);
+                advance(wake);
+            }
+        }
+        if (end <= hostNanos) throw RunEnd();
+    }
+};
+
+#endif
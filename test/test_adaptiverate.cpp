@@ -0,0 +1,105 @@
+// The command interval AdaptiveRate advertises under changing load
+#include <hosttest.h>
+
+#include "adaptiverate.h"
+
+// Reports whatever lateness a test sets
+class StallingDevice : public Device {
+   public:
+    uint32_t stall = 0;
+
+    uint32_t takeStall() {
+        uint32_t s = stall;
+        stall = 0;
+        return s;
+    }
+};
+
+struct Rig {
+    Config config{"Controller", 100};
+    StallingDevice device;
+    AdaptiveRate rate;
+
+    Rig() {
+        admission.shed = 0;  // as at boot, AdaptiveRate counts the sheds since
+        device.name = "Stalling";
+        config.addDevice(&device);
+        rate.setConfig(&config);
+        rate.rateMin = 50;
+        rate.rateMax = 1000;
+    }
+};
+
+TEST(idleShrinksToMinimum) {
+    Rig rig;
+    rig.rate.update();
+    CHECK_EQ(90, rig.config.rate);
+    rig.rate.update();
+    CHECK_EQ(81, rig.config.rate);
+    for (int i = 0; i < 20; i++)
+        rig.rate.update();
+    CHECK_EQ(50, rig.config.rate);
+}
+
+TEST(slowHandlerDoublesToMaximum) {
+    Rig rig;
+    for (int i = 0; i < 50; i++)
+        rig.rate.recordLatency(20000);
+    CHECK(rig.rate.latencyMax < rig.rate.latency);
+    rig.rate.update();
+    CHECK_EQ(200, rig.config.rate);
+    rig.rate.update();
+    rig.rate.update();
+    CHECK_EQ(800, rig.config.rate);
+    rig.rate.update();
+    CHECK_EQ(1000, rig.config.rate);
+}
+
+TEST(lateStepsCountAsBusy) {
+    Rig rig;
+    rig.device.stall = rig.rate.stallMax + 1;
+    rig.rate.update();
+    CHECK_EQ(200, rig.config.rate);
+    CHECK_EQ(rig.rate.stallMax + 1, rig.rate.stall);
+    rig.rate.update();  // the stall was taken, the interval is idle again
+    CHECK_EQ(180, rig.config.rate);
+}
+
+TEST(lowHeapCountsAsBusy) {
+    Rig rig;
+    uint32_t freeHeap = ESP.freeHeap;
+    ESP.freeHeap = rig.rate.heapMin - 1;
+    rig.rate.update();
+    ESP.freeHeap = freeHeap;
+    CHECK_EQ(200, rig.config.rate);
+}
+
+TEST(sheddingCountsAsBusy) {
+    Rig rig;
+    admission.shed++;
+    rig.rate.update();
+    CHECK_EQ(200, rig.config.rate);
+    rig.rate.update();  // no new sheds
+    CHECK_EQ(180, rig.config.rate);
+}
+
+TEST(admissionFollowsRate) {
+    Rig rig;
+    rig.config.rate = 1000;
+    rig.rate.update();  // 900 ms, one device
+    CHECK_EQ(900, rig.config.rate);
+    CHECK_EQ(2, admission.tokensPerSecond);
+    CHECK_EQ(2, admission.burst);
+}
+
+TEST(runsEveryInterval) {
+    Rig rig;
+    SchedulerClass::run(&rig.rate);
+    CHECK_EQ(90, rig.config.rate);
+    delay(rig.rate.interval - 1);
+    SchedulerClass::run(&rig.rate);
+    CHECK_EQ(90, rig.config.rate);
+    delay(1);
+    SchedulerClass::run(&rig.rate);
+    CHECK_EQ(81, rig.config.rate);
+}
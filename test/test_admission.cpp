@@ -0,0 +1,109 @@
+// Load shedding and the per-address token buckets of Admission
+#include <hosttest.h>
+
+#include "admission.h"
+
+// A rate limited request from [ip], disconnected at once if admitted, the
+// status it was refused with, 0 if it was admitted
+int request(Admission &admission, IPAddress ip) {
+    AsyncWebServerRequest r(ip);
+    if (!admission.admit(&r, true)) return r.code();
+    r.disconnect();
+    return 0;
+}
+
+TEST(burstThenRateLimited) {
+    Admission admission;
+    admission.burst = 4;
+    admission.tokensPerSecond = 10;
+    IPAddress ip(192, 168, 4, 2);
+    for (int i = 0; i < 4; i++)
+        CHECK_EQ(0, request(admission, ip));
+    AsyncWebServerRequest r(ip);
+    CHECK(!admission.admit(&r, true));
+    CHECK_EQ(429, r.code());
+    CHECK(r.response->headers["Retry-After"] == "1");
+    CHECK_EQ(1, admission.rateLimited);
+    CHECK_EQ(4, admission.accepted);
+}
+
+TEST(bucketRefillsAtRate) {
+    Admission admission;
+    admission.burst = 2;
+    admission.tokensPerSecond = 10;  // one per 100 ms
+    IPAddress ip(192, 168, 4, 2);
+    request(admission, ip);
+    request(admission, ip);
+    CHECK_EQ(429, request(admission, ip));
+    delay(99);
+    CHECK_EQ(429, request(admission, ip));
+    delay(1);
+    CHECK_EQ(0, request(admission, ip));
+    delay(10000);  // refills up to the burst, not beyond
+    CHECK_EQ(0, request(admission, ip));
+    CHECK_EQ(0, request(admission, ip));
+    CHECK_EQ(429, request(admission, ip));
+}
+
+TEST(addressesHaveTheirOwnBuckets) {
+    Admission admission;
+    admission.burst = 1;
+    IPAddress a(192, 168, 4, 2), b(192, 168, 4, 3);
+    CHECK_EQ(0, request(admission, a));
+    CHECK_EQ(429, request(admission, a));
+    CHECK_EQ(0, request(admission, b));
+}
+
+TEST(idlestBucketIsReplaced) {
+    Admission admission;
+    admission.burst = 1;
+    admission.tokensPerSecond = 1;
+    for (int i = 0; i < ADMISSION_MAX_CLIENTS; i++) {
+        CHECK_EQ(0, request(admission, IPAddress(10, 0, 0, i)));
+        delay(10);
+    }
+    CHECK_EQ(0, request(admission, IPAddress(10, 0, 0, 100)));  // takes the bucket of 10.0.0.0
+    CHECK_EQ(429, request(admission, IPAddress(10, 0, 0, 1)));  // still empty
+    CHECK_EQ(0, request(admission, IPAddress(10, 0, 0, 0)));   // starts over full
+}
+
+TEST(shedsAboveConcurrency) {
+    Admission admission;
+    admission.maxConcurrent = 2;
+    AsyncWebServerRequest a, b, c;
+    CHECK(admission.admit(&a));
+    CHECK(admission.admit(&b));
+    CHECK(!admission.admit(&c));
+    CHECK_EQ(503, c.code());
+    CHECK(c.response->headers["Retry-After"] == "1");
+    CHECK_EQ(1, admission.shed);
+    a.disconnect();
+    CHECK_EQ(1, admission.concurrent);
+    AsyncWebServerRequest d;
+    CHECK(admission.admit(&d));
+    b.disconnect();
+    d.disconnect();
+    CHECK_EQ(0, admission.concurrent);
+}
+
+TEST(shedsOnLowHeap) {
+    Admission admission;
+    uint32_t freeHeap = ESP.freeHeap;
+    ESP.freeHeap = admission.minFreeHeap - 1;
+    AsyncWebServerRequest r;
+    CHECK(!admission.admit(&r));
+    ESP.freeHeap = freeHeap;
+    CHECK_EQ(503, r.code());
+}
+
+TEST(rateSetsBucket) {
+    Admission admission;
+    admission.setRate(100, 1);  // a command per 100 ms
+    CHECK_EQ(10, admission.tokensPerSecond);
+    CHECK_EQ(2, admission.burst);
+    admission.setRate(30, 1);  // rounded up, never slower than asked
+    CHECK_EQ(34, admission.tokensPerSecond);
+    admission.setRate(0, 0);
+    CHECK_EQ(1000, admission.tokensPerSecond);
+    CHECK_EQ(2, admission.burst);
+}
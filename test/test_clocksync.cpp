@@ -0,0 +1,121 @@
+// ClockEstimate against simulated hosts whose clocks are off and drift
+#include <hosttest.h>
+#include <math.h>
+
+#include <clockestimate.h>
+
+// A clock [start] us ahead of true time that gains [ppm] per us
+struct SimClock {
+    double start;
+    double ppm;
+
+    uint32_t at(double t) const {
+        return (uint32_t)(uint64_t)(start + t + t * ppm / 1e6);
+    }
+
+    // True time at which the clock reads [reading], near [t]
+    double when(uint32_t reading, double t) const {
+        int32_t ahead = reading - at(t);
+        return t + ahead / (1 + ppm / 1e6);
+    }
+};
+
+// The link between the remote and a host: each way takes 1 ms plus up to
+// [jitter] us, from a fixed sequence so runs repeat
+struct Link {
+    uint32_t random = 1;
+    uint32_t jitter = 1000;
+
+    double delay() {
+        random = random * 1103515245 + 12345;
+        return 1000 + (random >> 8) % (jitter + 1);
+    }
+};
+
+// One sync of [samples] round trips at true time [t], returns when it ends
+double sync(ClockEstimate &estimate, const SimClock &local, const SimClock &host, Link &link, double t,
+            int samples = 4) {
+    estimate.begin();
+    for (int i = 0; i < samples; i++) {
+        uint32_t t0 = local.at(t);
+        t += link.delay();
+        uint32_t reading = host.at(t);
+        t += link.delay();
+        estimate.sample(t0, reading, local.at(t));
+    }
+    estimate.end();
+    return t;
+}
+
+TEST(keepsShortestRoundTrip) {
+    ClockEstimate estimate;
+    estimate.begin();
+    estimate.sample(1000, 6000, 1400);  // 400 us, host 5000 ahead at 1200
+    estimate.sample(2000, 7100, 2100);  // 100 us, host 5050 ahead at 2050
+    estimate.sample(3000, 9000, 3300);
+    CHECK(estimate.end());
+    CHECK_EQ(100, estimate.rtt);
+    CHECK_EQ(5050, estimate.offset);
+    CHECK_EQ(15050, estimate.hostTime(10000));
+}
+
+TEST(noSampleKeepsEstimate) {
+    ClockEstimate estimate;
+    estimate.begin();
+    CHECK(!estimate.end());
+    CHECK(!estimate.synced);
+}
+
+TEST(symmetricLinkIsExact) {
+    SimClock local{4294000000.0, 0};  // micros() wraps a second in
+    SimClock host{123456789, 0};
+    Link link;
+    link.jitter = 0;
+    ClockEstimate estimate;
+    double t = sync(estimate, local, host, link, 0);
+    CHECK_EQ(host.at(t + 5e6), estimate.hostTime(local.at(t + 5e6)));
+}
+
+TEST(measuresDrift) {
+    SimClock local{0, 0};
+    SimClock host{5000, 25};
+    Link link;
+    link.jitter = 0;
+    ClockEstimate estimate;
+    for (double t = 0; t < 300e6; t += 30e6)
+        sync(estimate, local, host, link, t);
+    CHECK(24.9e-6 < estimate.drift && estimate.drift < 25.1e-6);
+}
+
+// Two servers with their own offsets and crystal errors, each synced every
+// 30 s over a link with up to 1 ms jitter each way, like ClockSync does.
+// Once drift is measured, a command the remote schedules for both starts
+// on both, and when intended, within a millisecond.
+TEST(serversStartTogether) {
+    SimClock remote{1000000, -15};
+    SimClock servers[] = {{4294000000.0, 30}, {77000000, -20}};
+    Link links[] = {{7, 1000}, {11, 1000}};
+    ClockEstimate estimates[2];
+    double worst = 0;
+    double worstApart = 0;
+    double next = 0;
+    for (double t = 0; t < 3600e6; t += 1e6) {
+        if (next <= t) {
+            for (int s = 0; s < 2; s++)
+                sync(estimates[s], remote, servers[s], links[s], t);
+            next = t + 30e6;
+        }
+        if (t < 60e6) continue;  // drift is known from the second sync on
+        double intended = t + 50000;  // the dispatcher's scheduleDelay
+        double start[2];
+        for (int s = 0; s < 2; s++) {
+            uint32_t at = estimates[s].hostTime(remote.at(t)) + 50000;
+            start[s] = servers[s].when(at, intended);
+            double error = start[s] - intended;
+            if (worst < fabs(error)) worst = fabs(error);
+        }
+        if (worstApart < fabs(start[0] - start[1])) worstApart = fabs(start[0] - start[1]);
+    }
+    CHECK(worst < 1000);
+    CHECK(worstApart < 1000);
+}
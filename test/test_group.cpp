@@ -0,0 +1,239 @@
+// Group commands and heartbeats from a remote, over a loopback transport,
+// through GroupReceiver into the devices and their leases
+#include <hosttest.h>
+#include <simulation.h>
+
+#include <frametransport.h>
+#include <groupcommand.h>
+
+#include "groupreceiver.h"
+
+#define LEASE_TIME 5000
+
+// A server with a stepper following group "g" and one that is only
+// controlled over HTTP, and the remote's end of the link to it
+struct Rig {
+    Config config;
+    Stepper grouped{"Grouped"};
+    Stepper direct{"Direct"};
+    LoopbackTransport remote;
+    LoopbackTransport server;
+    GroupReceiver receiver;
+    uint32_t owner = ownerOf("remote1");
+    uint32_t sequence = 0;
+
+    Rig() {
+        hostNanos = 10000000000ull;  // 10 s after boot
+        config.leaseTime = LEASE_TIME;
+        grouped.group = "g";
+        config.addDevice(&grouped);
+        config.addDevice(&direct);
+        remote.connect(&server);
+        receiver.setConfig(&config);
+        receiver.addTransport(&server);
+    }
+
+    // A new command from remote1, or a repeat of the last one
+    void command(int32_t value, bool repeat = false) {
+        GroupCommand frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.magic = GROUP_MAGIC;
+        frame.session = 0x5e55;
+        frame.sequence = repeat ? sequence : ++sequence;
+        strncpy(frame.group, "g", GROUP_NAME_SIZE - 1);
+        strncpy(frame.client, "remote1", GROUP_CLIENT_SIZE - 1);
+        frame.command = value;
+        remote.send((const uint8_t *)&frame, sizeof(frame));
+    }
+
+    void heartbeat(uint16_t timeout) {
+        GroupHeartbeat frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.magic = GROUP_HEARTBEAT_MAGIC;
+        strncpy(frame.client, "remote1", GROUP_CLIENT_SIZE - 1);
+        frame.timeout = timeout;
+        remote.send((const uint8_t *)&frame, sizeof(frame));
+    }
+
+    // A control request from remote1 to the direct stepper
+    int control(const char *value) {
+        const char *pairs[] = {"device", "Direct", "command", value};
+        ControlArgs args(pairs, 2, owner);
+        char message[100];
+        return config.control(args, message, sizeof(message));
+    }
+
+    // The receiver's next poll, the beacons it sends back are dropped
+    void poll() {
+        delay(receiver.pollDelay);
+        SchedulerClass::run(&receiver);
+        uint8_t frame[TRANSPORT_FRAME_SIZE];
+        while (0 < remote.receive(frame, sizeof(frame))) {}
+    }
+};
+
+TEST(commandTakesLeaseAndApplies) {
+    Rig rig;
+    rig.command(100);
+    rig.poll();
+    CHECK_EQ(100, rig.grouped.setPoint);
+    CHECK_EQ(0, rig.direct.setPoint);
+    CHECK_EQ(1, rig.receiver.applied);
+    CHECK_EQ(rig.owner, rig.grouped.lease.owner);
+    CHECK(rig.grouped.lease.held(millis()));
+}
+
+TEST(repeatRenewsWithoutApplying) {
+    Rig rig;
+    rig.command(100);
+    rig.poll();
+    rig.grouped.setPoint = 7;  // would be overwritten by another apply
+    delay(3000);
+    rig.command(100, true);
+    rig.poll();
+    CHECK_EQ(7, rig.grouped.setPoint);
+    CHECK_EQ(1, rig.receiver.applied);
+    CHECK_EQ(millis() + LEASE_TIME, rig.grouped.lease.expires);
+}
+
+TEST(malformedFramesAreDropped) {
+    Rig rig;
+    uint8_t junk[12] = {1, 2, 3};
+    rig.remote.send(junk, sizeof(junk));
+    rig.poll();
+    CHECK_EQ(1, rig.receiver.received);
+    CHECK_EQ(1, rig.receiver.dropped);
+    CHECK_EQ(0, rig.receiver.applied);
+}
+
+TEST(heartbeatRenewsLease) {
+    Rig rig;
+    rig.command(100);
+    rig.poll();
+    delay(4000);
+    rig.heartbeat(400);
+    rig.poll();
+    CHECK_EQ(1, rig.receiver.heartbeats);
+    CHECK_EQ(millis() + LEASE_TIME, rig.grouped.lease.expires);
+    CHECK_EQ(400, rig.grouped.lease.linkTimeout);
+    delay(300);
+    rig.poll();
+    CHECK_EQ(0, rig.receiver.linksLost);
+    CHECK_EQ(100, rig.grouped.setPoint);
+}
+
+TEST(shortTimeoutsAreHeldToMinimum) {
+    Rig rig;
+    rig.command(100);
+    rig.poll();
+    rig.heartbeat(10);
+    rig.poll();
+    CHECK_EQ(rig.receiver.linkTimeoutMin, rig.grouped.lease.linkTimeout);
+}
+
+TEST(silenceStopsAndReleases) {
+    Rig rig;
+    rig.command(100);
+    rig.poll();
+    rig.heartbeat(400);
+    rig.poll();
+    delay(401);
+    rig.poll();
+    CHECK_EQ(1, rig.receiver.linksLost);
+    CHECK_EQ(0, rig.grouped.setPoint);
+    CHECK(!rig.grouped.lease.held(millis()));
+    CHECK_EQ(0, rig.grouped.lease.linkTimeout);
+    rig.poll();
+    CHECK_EQ(1, rig.receiver.linksLost);  // once per loss
+}
+
+TEST(repeatAfterLossAppliesAgain) {
+    Rig rig;
+    rig.command(100);
+    rig.poll();
+    rig.heartbeat(400);
+    rig.poll();
+    delay(500);
+    rig.poll();
+    CHECK_EQ(0, rig.grouped.setPoint);
+    rig.command(100, true);  // the sender's periodic repeat once the link is back
+    rig.poll();
+    CHECK_EQ(100, rig.grouped.setPoint);
+    CHECK_EQ(2, rig.receiver.applied);
+}
+
+TEST(groupFramesKeepHttpLeasesAlive) {
+    Rig rig;
+    CHECK_EQ(200, rig.control("50"));
+    rig.command(100);
+    rig.poll();
+    rig.heartbeat(400);
+    rig.poll();
+    CHECK_EQ(400, rig.direct.lease.linkTimeout);
+    for (int i = 0; i < 5; i++) {  // commands only, no heartbeats while they flow
+        delay(300);
+        rig.command(100 + i);
+        rig.poll();
+    }
+    CHECK_EQ(0, rig.receiver.linksLost);
+    CHECK_EQ(50, rig.direct.setPoint);
+    delay(401);
+    rig.poll();
+    CHECK_EQ(2, rig.receiver.linksLost);
+    CHECK_EQ(0, rig.direct.setPoint);
+}
+
+TEST(otherOwnersAreRefusedWhileLeased) {
+    Rig rig;
+    CHECK_EQ(200, rig.control("50"));
+    const char *pairs[] = {"device", "Direct", "command", "-50"};
+    ControlArgs args(pairs, 2, ownerOf("remote2"));
+    char message[100];
+    CHECK_EQ(409, rig.config.control(args, message, sizeof(message)));
+    CHECK_EQ(50, rig.direct.setPoint);
+}
+
+// A running motor on the simulated clock while the remote's heartbeats,
+// every 100 ms, stop for a request blocked its full timeout (250 ms), then
+// for 2 s: only the long gap stops the motor, which ramps down and starts
+// again once the remote's next request lands
+TEST(linkLossRampsDownAndRecovers) {
+    Rig rig;
+    Stepper motor{"Motor", D1, D2, D3, 200, 20000};
+    rig.config.addDevice(&motor);
+    Simulation sim;
+    sim.add(&motor);
+    sim.add(&rig.receiver);
+    uint64_t start = hostNanos;
+    auto control = [&rig]() {
+        const char *pairs[] = {"device", "Motor", "command", "400"};
+        ControlArgs args(pairs, 2, rig.owner);
+        char message[100];
+        rig.config.control(args, message, sizeof(message));
+    };
+    for (uint64_t t = 0; t < seconds(8); t += 100000000) {
+        bool blocked = seconds(2) < t && t < seconds(2) + 350000000;
+        bool lost = seconds(4) < t && t < seconds(6);
+        if (!blocked && !lost) sim.at(start + t, [&rig]() { rig.heartbeat(400); });
+    }
+    sim.at(start, control);
+    sim.at(start + seconds(6), control);
+    int lowest = 400;
+    bool ramped = false;  // seen between full speed and stopped
+    sim.every(1000000, [&]() {
+        if (0 < motor.command && motor.command < 400 && seconds(4) < hostNanos - start) ramped = true;
+        if (seconds(1) < hostNanos - start && motor.command < lowest) lowest = motor.command;  // up to speed
+    });
+    sim.run(seconds(4));
+    CHECK_EQ(0, rig.receiver.linksLost);
+    CHECK_EQ(400, lowest);
+    CHECK_EQ(400, motor.command);
+    sim.run(seconds(2) - 100000000);  // before the remote's next request
+    CHECK_EQ(1, rig.receiver.linksLost);
+    CHECK(ramped);
+    CHECK_EQ(0, motor.command);
+    CHECK(!motor.lease.held(millis()));
+    sim.run(seconds(2) + 100000000);
+    CHECK_EQ(400, motor.command);
+    CHECK_EQ(1, rig.receiver.linksLost);
+}
@@ -0,0 +1,83 @@
+// Soak of the control path with every heap allocation counted: built with
+// HEAP_COUNT_ALLOCATIONS and malloc wrapped, like the firmware, see Makefile
+#include <hosttest.h>
+#include <mallocnew.h>
+
+#include <heapmonitor.h>
+
+#include "config.h"
+
+// Throws the JSON away
+class NullPrint : public Print {
+   public:
+    size_t written = 0;
+
+    using Print::write;
+    size_t write(const uint8_t *, size_t size) override {
+        written += size;
+        return size;
+    }
+};
+
+TEST(allocationsAreCounted) {
+    uint32_t before = heapAllocations;
+    void *p = malloc(16);
+    p = realloc(p, 32);
+    free(p);
+    free(calloc(2, 8));
+    delete new int(1);
+    CHECK_EQ(4, heapAllocations - before);
+}
+
+TEST(probeCountsIntoHandlerStats) {
+    HandlerHeapStats *stats = heapMonitor.addHandler("probe");
+    CHECK(nullptr != stats);
+    for (int i = 0; i < 3; i++) {
+        HeapProbe probe(stats);
+        free(malloc(8));
+    }
+    CHECK_EQ(3, stats->calls);
+    CHECK_EQ(3, stats->allocations);
+}
+
+TEST(controlSoakDoesNotAllocate) {
+    Config config;
+    Stepper first("First");
+    Stepper second("Second");
+    config.addDevice(&first);
+    config.addDevice(&second);
+    HandlerHeapStats *stats = heapMonitor.addHandler("control");
+    const char *names[] = {"First", "Second", "0", "1", "Missing"};
+    const char *clients[] = {"remote1", "remote2"};
+    char command[12];
+    char message[100];
+    int codes[600] = {0};
+    for (int i = 0; i < 100000; i++) {
+        snprintf(command, sizeof(command), "%d", i % 1024 - 512);
+        const char *pairs[] = {"device", names[i % 5], "command", command, "slew", "20", "verbose", "1"};
+        ControlArgs args(pairs, i % 3 + 2, ownerOf(clients[i / 1000 % 2]));
+        HeapProbe probe(stats);
+        codes[config.control(args, message, sizeof(message)) % 600]++;
+        delay(1);
+    }
+    CHECK_EQ(100000, stats->calls);
+    CHECK_EQ(0, stats->allocations);
+    CHECK(0 < codes[200]);
+    CHECK(0 < codes[409]);  // the other remote while the lease runs
+    CHECK(0 < codes[500]);  // the missing device
+}
+
+TEST(configJsonDoesNotAllocate) {
+    Config config;
+    Stepper stepper("Stepper1");
+    stepper.group = "steppers";
+    config.addDevice(&stepper);
+    NullPrint out;
+    uint32_t before = heapAllocations;
+    for (int i = 0; i < 1000; i++) {
+        JsonWriter json(&out);
+        config.writeJson(json, i % 2 ? JSON_MODE_PUBLIC : JSON_MODE_PRIVATE);
+    }
+    CHECK_EQ(0, heapAllocations - before);
+    CHECK(0 < out.written);
+}
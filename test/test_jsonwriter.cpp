@@ -0,0 +1,80 @@
+// JSON streamed by JsonWriter, and the config documents built with it
+#include <string>
+
+#include <hosttest.h>
+
+#include "config.h"
+#include "jsonwriter.h"
+
+// Collects the JSON written
+class StringPrint : public Print {
+   public:
+    std::string text;
+
+    using Print::write;
+    size_t write(const uint8_t *buffer, size_t size) override {
+        text.append((const char *)buffer, size);
+        return size;
+    }
+};
+
+TEST(writesNestedDocument) {
+    StringPrint out;
+    JsonWriter json(&out);
+    json.beginObject()
+        .value("name", "Controller")
+        .value("rate", 10)
+        .value("on", true)
+        .beginArray("devices")
+        .beginObject()
+        .value("min", -1024)
+        .endObject()
+        .beginObject()
+        .endObject()
+        .endArray()
+        .beginArray("empty")
+        .endArray()
+        .value("last", (unsigned long)4000000000ul)
+        .endObject();
+    CHECK(out.text ==
+          "{\"name\":\"Controller\",\"rate\":10,\"on\":true,"
+          "\"devices\":[{\"min\":-1024},{}],\"empty\":[],\"last\":4000000000}");
+}
+
+TEST(arrayValuesHaveNoKeys) {
+    StringPrint out;
+    JsonWriter json(&out);
+    json.beginArray();
+    for (int i = 0; i < 3; i++)
+        json.value(nullptr, i);
+    json.value(nullptr, (const char *)nullptr).value(nullptr, false).endArray();
+    CHECK(out.text == "[0,1,2,null,false]");
+}
+
+TEST(escapesStrings) {
+    StringPrint out;
+    JsonWriter json(&out);
+    json.beginObject().value("s", "a\"b\\c\nd\te\x01").endObject();
+    CHECK(out.text == "{\"s\":\"a\\\"b\\\\c\\nd\\u0009e\\u0001\"}");
+}
+
+TEST(writesConfig) {
+    Config config("Desk", 20);
+    config.leaseTime = 3000;
+    Stepper stepper("Stepper1", 5, 4, 0, 200, 15000, 1, -1024, 1024);
+    stepper.group = "steppers";
+    config.addDevice(&stepper);
+    StringPrint pub;
+    JsonWriter json(&pub);
+    config.writeJson(json, JSON_MODE_PUBLIC);
+    CHECK(pub.text ==
+          "{\"name\":\"Desk\",\"rate\":20,\"lease\":3000,\"devices\":["
+          "{\"name\":\"Stepper1\",\"type\":\"stepper\",\"group\":\"steppers\","
+          "\"commandMin\":-1024,\"commandMax\":1024}]}");
+    StringPrint priv;
+    JsonWriter privJson(&priv);
+    config.writeJson(privJson);
+    CHECK(std::string::npos != priv.text.find("\"mdnsService\":\"http\",\"apiPort\":50123"));
+    CHECK(std::string::npos != priv.text.find("\"pinEnable\":5,\"pinDirection\":4,\"pinPulse\":0,"
+                                              "\"pulseMin\":200,\"pulseMax\":15000,\"pulseWidth\":1}"));
+}
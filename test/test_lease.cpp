@@ -0,0 +1,85 @@
+// Lease arbitration of control requests in Config::control
+#include <hosttest.h>
+
+#include "config.h"
+
+#define LEASE_TIME 5000
+
+struct Rig {
+    Config config;
+    Stepper stepper{"Stepper1"};
+
+    Rig() {
+        hostNanos = 10000000000ull;  // 10 s after boot
+        config.leaseTime = LEASE_TIME;
+        config.addDevice(&stepper);
+    }
+
+    // A request from [client], without a command if it is nullptr
+    int control(const char *client, const char *command, const char *priority = "0") {
+        const char *pairs[] = {"device", "Stepper1", "priority", priority, "command", command};
+        ControlArgs args(pairs, nullptr == command ? 2 : 3, ownerOf(client));
+        char message[100];
+        return config.control(args, message, sizeof(message));
+    }
+};
+
+TEST(firstCommandTakesLease) {
+    Rig rig;
+    CHECK_EQ(200, rig.control("a", "10"));
+    CHECK_EQ(ownerOf("a"), rig.stepper.lease.owner);
+    CHECK_EQ(millis() + LEASE_TIME, rig.stepper.lease.expires);
+}
+
+TEST(othersRefusedUntilExpiry) {
+    Rig rig;
+    rig.control("a", "10");
+    delay(LEASE_TIME - 1);
+    CHECK_EQ(409, rig.control("b", "20"));
+    CHECK_EQ(10, rig.stepper.setPoint);
+    delay(1);
+    CHECK_EQ(200, rig.control("b", "20"));
+    CHECK_EQ(20, rig.stepper.setPoint);
+    CHECK_EQ(ownerOf("b"), rig.stepper.lease.owner);
+}
+
+TEST(commandsRenewLease) {
+    Rig rig;
+    rig.control("a", "10");
+    delay(4000);
+    rig.control("a", "11");
+    delay(4000);
+    CHECK_EQ(409, rig.control("b", "20"));
+}
+
+TEST(higherPriorityTakesOver) {
+    Rig rig;
+    rig.control("a", "10", "1");
+    CHECK_EQ(409, rig.control("b", "20", "1"));
+    CHECK_EQ(200, rig.control("b", "20", "2"));
+    CHECK_EQ(409, rig.control("a", "30", "1"));
+}
+
+TEST(refusedCommandDoesNotTakeLease) {
+    Rig rig;
+    CHECK_EQ(400, rig.control("a", nullptr));  // no command
+    CHECK_EQ(0, rig.stepper.lease.owner);
+    CHECK_EQ(200, rig.control("b", "20"));
+}
+
+TEST(refusedCommandDoesNotRenewLease) {
+    Rig rig;
+    rig.control("a", "10");
+    delay(4000);
+    CHECK_EQ(400, rig.control("a", nullptr));
+    delay(1000);
+    CHECK_EQ(200, rig.control("b", "20"));
+}
+
+TEST(refusedHigherPriorityDoesNotTakeOver) {
+    Rig rig;
+    rig.control("a", "10");
+    CHECK_EQ(400, rig.control("b", nullptr, "5"));
+    CHECK_EQ(ownerOf("a"), rig.stepper.lease.owner);
+    CHECK_EQ(0, rig.stepper.lease.priority);
+}
@@ -0,0 +1,91 @@
+// Deferred log records drained to a serial port with a small FIFO
+#include <string>
+
+#include <hosttest.h>
+
+#include <log.h>
+
+// One drain pass with [free] bytes of room in the FIFO
+void drain(int free) {
+    Serial.writable = free;
+    delay(logTask.drainDelay);
+    SchedulerClass::run(&logTask);
+}
+
+void reset() {
+    while (!logBuffer.empty()) logBuffer.pop();
+    drain(-1);
+    Serial.output.clear();
+    Serial.blocked = 0;
+}
+
+TEST(formatsWhenDrained) {
+    reset();
+    const char *name = "Stepper1";
+    LOG_W("[Test] %s: %d steps\n", name, 42);
+    CHECK(Serial.output.empty());
+    drain(128);
+    CHECK(Serial.output == "[Test] Stepper1: 42 steps\n");
+    CHECK(logBuffer.empty());
+}
+
+TEST(waitsForRoomInFifo) {
+    reset();
+    LOG_W("[Test] first\n");
+    LOG_W("[Test] second\n");
+    drain(20);  // the first and part of the second
+    CHECK(Serial.output == "[Test] first\n[Test] ");
+    drain(0);
+    CHECK(Serial.output == "[Test] first\n[Test] ");
+    drain(128);
+    CHECK(Serial.output == "[Test] first\n[Test] second\n");
+    CHECK_EQ(0, Serial.blocked);
+    CHECK(logBuffer.empty());
+}
+
+TEST(linesLongerThanFifoGoOutInPieces) {
+    reset();
+    std::string text(140, 'x');  // outlives the record
+    LOG_W("[Test] %s\n", text.c_str());
+    std::string expected = "[Test] " + text + "\n";
+    int passes = 0;
+    while (!logBuffer.empty() && passes < 10) {
+        drain(Serial.fifoSize);
+        passes++;
+    }
+    CHECK_EQ(2, passes);
+    CHECK(expected == Serial.output);
+    CHECK_EQ(0, Serial.blocked);
+}
+
+TEST(linesLongerThanLineSizeAreCut) {
+    reset();
+    std::string text(300, 'y');
+    LOG_W("%s", text.c_str());
+    for (int i = 0; i < 10 && !logBuffer.empty(); i++)
+        drain(16);
+    CHECK(logBuffer.empty());
+    CHECK_EQ(LOG_LINE_SIZE - 1, Serial.output.size());
+    CHECK(std::string(LOG_LINE_SIZE - 1, 'y') == Serial.output);
+}
+
+TEST(reportsDroppedRecords) {
+    reset();
+    uint32_t dropped = logBuffer.dropped;
+    for (int i = 0; i < LOG_BUFFER_SIZE + 3; i++)
+        LOG_W("[Test] %d\n", i);
+    CHECK_EQ(dropped + 3, logBuffer.dropped);
+    for (int i = 0; i < 100 && !logBuffer.empty(); i++)
+        drain(64);
+    drain(64);
+    CHECK(std::string::npos != Serial.output.find("[Test] 31\n"));
+    CHECK(std::string::npos == Serial.output.find("[Test] 32\n"));
+    CHECK(std::string::npos != Serial.output.find("[Log] 3 messages dropped\n"));
+    CHECK_EQ(0, Serial.blocked);
+}
+
+TEST(debugIsCompiledOut) {
+    reset();
+    LOG_D("[Test] debug\n");
+    CHECK(logBuffer.empty());
+}
@@ -0,0 +1,181 @@
+// The pin capture of a Stepper on the simulated clock: the step metrics
+// and the VCD export of what the motor wrote to its pins
+#include <hosttest.h>
+#include <simulation.h>
+
+#define CAPTURE_SIZE 4096  // the whole run, see the capture's own limit below
+#include <pincapture.h>
+
+#include "devices.h"
+
+#include <string>
+#include <vector>
+
+struct Rig {
+    Stepper motor{"Motor", D1, D2, D3, 200, 20000};
+    Simulation sim;
+
+    Rig() {
+        pinCapture = PinCapture();
+        sim.add(&motor);
+        sim.run(1000000);  // setup() adds the channels
+        pinCapture.arm();
+    }
+
+    void control(const char *command) {
+        const char *pairs[] = {"command", command};
+        ControlArgs args(pairs, 1, ownerOf("remote1"));
+        char message[100];
+        motor.control(args, message, sizeof(message));
+    }
+
+    // Forward, back, forward again and stop, 200 ms each
+    void run() {
+        uint64_t start = hostNanos;
+        const char *commands[] = {"200", "-200", "200", "0"};
+        for (int i = 0; i < 4; i++)
+            sim.at(start + i * 200000000ull, [this, i, commands]() { control(commands[i]); });
+        sim.run(seconds(1));
+    }
+
+    std::string vcd() {
+        pinCapture.beginExport();
+        std::string out;
+        uint8_t buf[37];  // smaller than a line, so lines are split across reads
+        size_t len;
+        while (0 < (len = pinCapture.read(buf, sizeof(buf))))
+            out.append((const char *)buf, len);
+        return out;
+    }
+};
+
+std::vector<std::string> lines(const std::string &text) {
+    std::vector<std::string> out;
+    size_t start = 0;
+    for (size_t end; std::string::npos != (end = text.find('\n', start)); start = end + 1)
+        out.push_back(text.substr(start, end - start));
+    return out;
+}
+
+TEST(metricsCountStepsAndReversals) {
+    Rig rig;
+    rig.run();
+    CHECK(pinCapture.armed);  // nothing lost to a full buffer
+    StepMetrics m = pinCapture.stepMetrics(D3, D2, 1000, 650, 100000000);
+    CHECK(100 < m.steps);
+    CHECK_EQ(rig.motor.jitter()->count, m.steps);  // one lateness sample per pulse
+    CHECK_EQ(3, m.directionChanges);
+    CHECK_EQ(0, m.setupViolations);
+    CHECK(650 <= m.setupMin);
+    CHECK_EQ(0, m.widthViolations);
+    CHECK(1000 <= m.pulseWidthMin);
+    CHECK_EQ(0, rig.motor.command);
+    // a window per 100 ms: stepping in the first, stopped in the last
+    CHECK(0 < m.stepsPerWindow[0]);
+    CHECK_EQ(0, m.stepsPerWindow[9]);
+}
+
+// Writes of the level a pin already has are not edges, see 55e0e72
+TEST(rewrittenDirectionIsNoChange) {
+    PinCapture capture;
+    capture.addChannel(D2, "Motor", "direction");
+    capture.addChannel(D3, "Motor", "pulse");
+    digitalWrite(D2, HIGH);
+    digitalWrite(D3, LOW);
+    capture.arm();
+    capture.record(D2, HIGH);  // rewritten
+    delayMicroseconds(1);
+    capture.record(D3, HIGH);  // right after it, but no change to set up
+    delayMicroseconds(1);
+    capture.record(D3, LOW);
+    capture.record(D2, LOW);
+    delayMicroseconds(1);
+    capture.record(D3, HIGH);
+    delayMicroseconds(1);
+    capture.record(D3, LOW);
+    StepMetrics m = capture.stepMetrics(D3, D2, 500, 650, 0);
+    CHECK_EQ(2, m.steps);
+    CHECK_EQ(1, m.directionChanges);
+    CHECK_EQ(0, m.setupViolations);
+}
+
+TEST(vcdHasHeaderAndEveryEdge) {
+    Rig rig;
+    rig.run();
+    std::vector<std::string> vcd = lines(rig.vcd());
+    const char *header[] = {
+        "$timescale 100 ns $end",
+        "$scope module esp8266 $end",
+        "$var wire 1 ! Motor.enable $end",
+        "$var wire 1 \" Motor.direction $end",
+        "$var wire 1 # Motor.pulse $end",
+        "$upscope $end",
+        "$enddefinitions $end",
+        "#0",
+        "$dumpvars",
+        "0!",  // disabled
+        "1\"",  // backwards, see Stepper::setup()
+        "0#",
+        "$end",
+    };
+    size_t headerLines = sizeof(header) / sizeof(header[0]);
+    CHECK(headerLines < vcd.size());
+    for (size_t i = 0; i < headerLines && i < vcd.size(); i++)
+        CHECK(vcd[i] == header[i]);
+    // then a time line before the edges at that time, times increasing
+    uint32_t rises = 0;
+    uint32_t edges = 0;
+    long last = -1;
+    bool timed = false;
+    bool ordered = true;
+    bool wellFormed = true;
+    for (size_t i = headerLines; i < vcd.size(); i++) {
+        const std::string &line = vcd[i];
+        if ('#' == line[0] && 1 < line.size()) {
+            long time = atol(line.c_str() + 1);
+            ordered = ordered && last < time;
+            last = time;
+            timed = true;
+            continue;
+        }
+        wellFormed = wellFormed && timed && 2 == line.size() && ('0' == line[0] || '1' == line[0]) &&
+                     '!' <= line[1] && line[1] <= '#';
+        edges++;
+        if ("1#" == line) rises++;
+    }
+    CHECK(ordered);
+    CHECK(wellFormed);
+    CHECK_EQ(pinCapture.count, edges);
+    CHECK_EQ(pinCapture.stepMetrics(D3, D2, 1000, 650, 0).steps, rises);
+    // the run lasted a second, in 100 ns units
+    CHECK(9000000 < last && last < 10000000);
+}
+
+// The FastStepper's pulses through the set/clear registers, timed on the
+// cycle counter: the same metrics, and every pulse on time
+TEST(fastStepperPulsesOnTime) {
+    pinCapture = PinCapture();
+    FastStepper<D1, D2, D3> motor("Fast", 200, 20000, 1, -1024, 1024);
+    Simulation sim;
+    sim.add(&motor);
+    sim.run(1000000);
+    pinCapture.arm();
+    const char *commands[] = {"200", "-200", "0"};
+    for (int i = 0; i < 3; i++)
+        sim.at(hostNanos + i * 200000000ull, [&motor, i, commands]() {
+            const char *pairs[] = {"command", commands[i]};
+            ControlArgs args(pairs, 1, ownerOf("remote1"));
+            char message[100];
+            motor.control(args, message, sizeof(message));
+        });
+    sim.run(seconds(1));
+    CHECK(pinCapture.armed);
+    StepMetrics m = pinCapture.stepMetrics(D3, D2, 1000, 650, 0);
+    CHECK(40 < m.steps);
+    CHECK_EQ(motor.jitter()->count + 2, m.steps);  // the last pulse of each run has no pause
+    CHECK_EQ(2, m.directionChanges);
+    CHECK_EQ(0, m.setupViolations);
+    CHECK_EQ(0, m.widthViolations);
+    CHECK_EQ(0, motor.jitter()->max);  // the last yieldMargin is spun, never late
+    CHECK_EQ(0, motor.command);
+}
@@ -0,0 +1,53 @@
+// The remote's input to request functions the client's devices call
+#include <hosttest.h>
+
+#include <remotecommand.h>
+
+TEST(averageStaysInRange) {
+    CHECK_EQ(500, averageReading(500 * 64, 64, 0, 1024));
+    CHECK_EQ(1024, averageReading(2000 * 64, 64, 0, 1024));  // overflowed
+    CHECK_EQ(10, averageReading(0, 64, 10, 1024));
+}
+
+TEST(potDirectionCommandFollowsSwitches) {
+    CHECK_EQ(0, potDirectionCommand(1024, 0, 1024, false, false, false, -200, 200));
+    CHECK_EQ(1, potDirectionCommand(0, 0, 1024, false, true, false, -200, 200));
+    CHECK_EQ(200, potDirectionCommand(1024, 0, 1024, false, true, false, -200, 200));
+    CHECK_EQ(-200, potDirectionCommand(1024, 0, 1024, false, true, true, -200, 200));
+    CHECK_EQ(-1, potDirectionCommand(1024, 0, 1024, true, true, true, -200, 200));
+}
+
+TEST(commandPathHasAtOnlyWhenScheduled) {
+    char path[128];
+    formatCommandPath(path, sizeof(path), "Stepper1", -300, 20, 0, "00c0ffee", 1);
+    CHECK(0 == strcmp("/api/control?device=Stepper1&command=-300&slew=20&client=00c0ffee&priority=1", path));
+    formatCommandPath(path, sizeof(path), "Stepper1", 5, 0, 4000000000u, "00c0ffee", 0);
+    CHECK(0 == strcmp("/api/control?device=Stepper1&command=5&slew=0&at=4000000000&client=00c0ffee&priority=0", path));
+}
+
+TEST(txtConfigHasEveryDevice) {
+    char txts[] = "v=1;rate=200;lease=5000;n=2;d0=Stepper1,stepper,-1024,1024;d1=Led,led";
+    TxtConfig conf;
+    CHECK(parseTxtConfig(txts, conf));
+    CHECK_EQ(200, conf.rate);
+    CHECK(conf.hasLease);
+    CHECK_EQ(5000, conf.lease);
+    CHECK_EQ(2, conf.found);
+    CHECK(0 == strcmp("Stepper1", conf.devices[0].name));
+    CHECK(conf.devices[0].range);
+    CHECK_EQ(-1024, conf.devices[0].commandMin);
+    CHECK(0 == strcmp("led", conf.devices[1].type));
+    CHECK(!conf.devices[1].range);
+}
+
+TEST(txtConfigUnusableWhenIncomplete) {
+    char truncated[] = "v=1;rate=200;n=2;d0=Stepper1,stepper,-1024,1024";
+    TxtConfig conf;
+    CHECK(!parseTxtConfig(truncated, conf));
+    char otherVersion[] = "v=2;rate=200;n=0";
+    TxtConfig conf2;
+    CHECK(!parseTxtConfig(otherVersion, conf2));
+    char noRate[] = "v=1;n=0";
+    TxtConfig conf3;
+    CHECK(!parseTxtConfig(noRate, conf3));
+}
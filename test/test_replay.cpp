@@ -0,0 +1,174 @@
+// Replaying a recording file the recorder appended to over several boots
+#include <hosttest.h>
+
+#include "replayer.h"
+
+#define OWNER 1
+
+class TestRecorder : public CommandRecorder {
+   public:
+    using CommandRecorder::flush;
+
+    void record(int command) {
+        CommandRecorder::record(0, OWNER, command, 0, 0, 0, 200, RECORD_ORIGIN_HTTP);
+    }
+};
+
+struct Rig {
+    Config config;
+    Stepper stepper{"Stepper1"};
+
+    Rig() {
+        LittleFS.files.clear();
+        config.addDevice(&stepper);
+        replayer.setConfig(&config);
+    }
+
+    ~Rig() {
+        replayer.stop();
+    }
+
+    // A few scheduler passes at the current time
+    void run() {
+        for (int i = 0; i < 4; i++)
+            SchedulerClass::run(&replayer);
+    }
+};
+
+const size_t headerSize = sizeof(RecordingHeader);
+const size_t recordSize = sizeof(CommandRecord);
+
+// Two records 1 s apart in a boot that starts at [seconds] since the last one
+void recordBoot(unsigned long seconds, int command) {
+    hostNanos = seconds * 1000000000ull;
+    TestRecorder boot;
+    boot.record(command);
+    boot.flush();
+    delay(1000);
+    boot.record(command + 1);
+    boot.flush();
+}
+
+TEST(firstFlushMarksBoot) {
+    Rig rig;
+    recordBoot(100, 1);
+    File file = LittleFS.open(RECORDING_FILE, "r");
+    CHECK_EQ(headerSize + 3 * recordSize, file.size());
+    CommandRecord record;
+    file.seek(headerSize);
+    file.read((uint8_t *)&record, sizeof(record));
+    CHECK_EQ(RECORD_ORIGIN_BOOT, record.origin);
+    file.read((uint8_t *)&record, sizeof(record));
+    CHECK_EQ(RECORD_ORIGIN_HTTP, record.origin);
+    CHECK_EQ(100000, record.time);
+}
+
+TEST(secondBootAppendsMarker) {
+    Rig rig;
+    recordBoot(100, 1);
+    recordBoot(5, 3);
+    File file = LittleFS.open(RECORDING_FILE, "r");
+    CHECK_EQ(headerSize + 6 * recordSize, file.size());
+    CommandRecord record;
+    file.seek(headerSize + 3 * recordSize);
+    file.read((uint8_t *)&record, sizeof(record));
+    CHECK_EQ(RECORD_ORIGIN_BOOT, record.origin);
+}
+
+TEST(newFileAfterRotationMarksBoot) {
+    Rig rig;
+    hostNanos = 100000000000ull;
+    TestRecorder recorder;
+    recorder.fileMax = headerSize + 3 * recordSize;
+    recorder.record(1);
+    recorder.record(2);
+    recorder.flush();  // full, moved to the old file
+    CHECK(LittleFS.exists(RECORDING_FILE_OLD));
+    CHECK(!LittleFS.exists(RECORDING_FILE));
+    delay(1000);
+    recorder.record(3);
+    recorder.flush();
+    File file = LittleFS.open(RECORDING_FILE, "r");
+    CHECK_EQ(headerSize + 2 * recordSize, file.size());
+    CommandRecord record;
+    file.seek(headerSize);
+    file.read((uint8_t *)&record, sizeof(record));
+    CHECK_EQ(RECORD_ORIGIN_BOOT, record.origin);
+    file.read((uint8_t *)&record, sizeof(record));
+    CHECK_EQ(3, record.command);
+}
+
+TEST(spacingRestartsAtBoot) {
+    Rig rig;
+    recordBoot(100, 1);
+    recordBoot(5, 3);  // earlier times than the first boot
+    hostNanos = 200000000000ull;
+    CHECK(replayer.start(1, RECORDING_FILE));
+    rig.run();
+    CHECK_EQ(1, replayer.replayed);
+    delay(999);
+    rig.run();
+    CHECK_EQ(1, replayer.replayed);
+    delay(1);
+    rig.run();
+    CHECK_EQ(3, replayer.replayed);  // the first of the next boot right away
+    CHECK_EQ(3, rig.stepper.setPoint);
+    delay(999);
+    rig.run();
+    CHECK_EQ(3, replayer.replayed);
+    delay(1);
+    rig.run();
+    CHECK_EQ(4, replayer.replayed);
+    CHECK_EQ(4, rig.stepper.setPoint);
+    CHECK(!replayer.running);
+    CHECK_EQ(0, replayer.mismatched);
+}
+
+TEST(timeGoingBackwardsRestartsSpacing) {
+    Rig rig;
+    // a file without boot records, as recorded before they were added
+    File file = LittleFS.open("/old.bin", "w");
+    TestRecorder().writeHeader(file);
+    uint32_t times[] = {100000, 101000, 5000, 6000};
+    for (int i = 0; i < 4; i++) {
+        CommandRecord record = {};
+        record.time = times[i];
+        record.owner = OWNER;
+        record.command = i + 1;
+        record.status = 200;
+        file.write((const uint8_t *)&record, sizeof(record));
+    }
+    file.close();
+    CHECK(replayer.start(1, "/old.bin"));
+    rig.run();
+    delay(1000);
+    rig.run();
+    CHECK_EQ(3, replayer.replayed);
+    delay(1000);
+    rig.run();
+    CHECK_EQ(4, replayer.replayed);
+    CHECK(!replayer.running);
+}
+
+TEST(millisWrapKeepsSpacing) {
+    Rig rig;
+    File file = LittleFS.open("/wrap.bin", "w");
+    TestRecorder().writeHeader(file);
+    uint32_t times[] = {UINT32_MAX - 499, 500};
+    for (int i = 0; i < 2; i++) {
+        CommandRecord record = {};
+        record.time = times[i];
+        record.owner = OWNER;
+        record.status = 200;
+        file.write((const uint8_t *)&record, sizeof(record));
+    }
+    file.close();
+    CHECK(replayer.start(1, "/wrap.bin"));
+    rig.run();
+    delay(999);
+    rig.run();
+    CHECK_EQ(1, replayer.replayed);
+    delay(1);
+    rig.run();
+    CHECK_EQ(2, replayer.replayed);
+}
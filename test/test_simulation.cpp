@@ -0,0 +1,112 @@
+// Days of the server's tasks on the simulated clock, see host/simulation.h
+#include <hosttest.h>
+#include <simulation.h>
+
+#include "adaptiverate.h"
+#include "config.h"
+#include "recorder.h"
+
+#include <string>
+
+#define WRAP_MICROS 4294967296ull  // micros() wraps every 2^32 us, 71.6 min
+
+struct Server {
+    Config config;
+    Stepper stepper{"Stepper1", D1, D2, D3, 200, 20000};  // 50 Hz at the slowest, ramps take < 1 s
+    CommandRecorder commands;
+    AdaptiveRate rate;
+    Simulation sim;
+
+    Server() {
+        hostNanos = 0;
+        admission.shed = 0;
+        LittleFS.files.clear();
+        config.addDevice(&stepper);
+        config.recorder = &commands;
+        commands.persist = true;
+        rate.setConfig(&config);
+        sim.add(&stepper);
+        sim.add(&commands);
+        sim.add(&rate);
+    }
+
+    int control(const char *command, const char *at = nullptr) {
+        const char *pairs[] = {"device", "Stepper1", "command", command, "at", at};
+        ControlArgs args(pairs, nullptr == at ? 2 : 3, ownerOf("remote1"));
+        char message[100];
+        return config.control(args, message, sizeof(message));
+    }
+
+    // Runs the motor for 100 ms every hour from [start]
+    void hourly(uint64_t start, const char *command) {
+        for (uint64_t t = start; t < days(2); t += hours(1)) {
+            sim.at(t, [this, command]() { control(command); });
+            sim.at(t + 100000000, [this]() { control("0"); });
+        }
+    }
+};
+
+TEST(daysRunInJumps) {
+    Server server;
+    server.hourly(hours(1), "400");
+    server.sim.run(days(2));
+    CHECK_EQ(days(2), hostNanos);
+    CHECK_EQ(94, server.commands.total);
+    CHECK_EQ(94, server.sim.events);
+    CHECK_EQ(0, server.stepper.command);
+    CHECK(server.sim.jumps < server.sim.passes);
+    // every record reached the file, after the header and the boot record
+    CHECK_EQ(sizeof(RecordingHeader) + 95 * sizeof(CommandRecord),
+             LittleFS.open(RECORDING_FILE, "r").size());
+    CHECK_EQ(server.rate.rateMin, server.config.rate);  // never busy
+}
+
+// 64 random commands over 6 hours, each stopped 200 ms later: the
+// speed 100 ms into each, then the recording file
+std::string randomRun(uint32_t seed) {
+    Server server;
+    uint32_t random = seed;
+    static char commands[64][12];
+    std::string trace;
+    for (int i = 0; i < 64; i++) {
+        random = random * 1103515245 + 12345;
+        snprintf(commands[i], sizeof(commands[i]), "%d", (int)(random >> 16) % 1024 - 512);
+        uint64_t sent = hours(6) * i / 64 + random % seconds(60);
+        server.sim.at(sent, [&server, i]() { server.control(commands[i]); });
+        server.sim.at(sent + 100000000, [&server, &trace]() {
+            trace += std::to_string(server.stepper.command) + " ";
+        });
+        server.sim.at(sent + 200000000, [&server]() { server.control("0"); });
+    }
+    server.sim.run(hours(6));
+    File file = LittleFS.open(RECORDING_FILE, "r");
+    std::string recording(file.size(), '\0');
+    file.read((uint8_t *)&recording[0], recording.size());
+    return trace + recording;
+}
+
+TEST(runsRepeatExactly) {
+    std::string first = randomRun(1);
+    CHECK(sizeof(RecordingHeader) + 129 * sizeof(CommandRecord) < first.size());
+    CHECK(first == randomRun(1));
+    CHECK(first != randomRun(2));
+}
+
+TEST(scheduledCommandsStartOnTimeAcrossMicrosWrap) {
+    Server server;
+    static char at[12];
+    int late = 0;
+    for (uint64_t wrap = WRAP_MICROS; wrap < 5 * WRAP_MICROS; wrap += WRAP_MICROS) {
+        uint64_t sent = (wrap - 3000) * 1000;  // 3 ms before micros() wraps
+        server.sim.at(sent, [&server]() {
+            snprintf(at, sizeof(at), "%lu", (unsigned long)(uint32_t)(micros() + 5000));
+            server.control("200", at);
+        });
+        server.sim.at(sent + 4999000, [&server, &late]() { late += 0 != server.stepper.setPoint; });
+        server.sim.at(sent + 5001000, [&server, &late]() { late += 200 != server.stepper.setPoint; });
+        server.sim.at(sent + seconds(1), [&server]() { server.control("0"); });
+    }
+    server.sim.run(5 * WRAP_MICROS * 1000);
+    CHECK_EQ(0, late);
+    CHECK_EQ(8, server.commands.total);
+}
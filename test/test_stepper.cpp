@@ -0,0 +1,152 @@
+// Set points of the Stepper: scheduled, immediate and slewed commands, the
+// ramp towards them, and the direction setup time
+#include <hosttest.h>
+
+#include "devices.h"
+
+class TestStepper : public Stepper {
+   public:
+    using Stepper::directionLevel;
+    using Stepper::calculatePause;
+    using Stepper::easeCommandToSetPoint;
+    using Stepper::loop;
+    using Stepper::pending;
+    using Stepper::writeDirection;
+
+    TestStepper() : Stepper("Stepper1", 5, 4, 0, 200, 15000, 1, -1024, 1024, 100) {}
+};
+
+int control(Stepper &stepper, const char *command, const char *at = nullptr, const char *slew = "0") {
+    const char *pairs[] = {"command", command, "slew", slew, "at", at};
+    ControlArgs args(pairs, nullptr == at ? 2 : 3, ownerOf("remote1"));
+    char message[100];
+    return stepper.control(args, message, sizeof(message));
+}
+
+const char *microsFromNow(unsigned long us) {
+    static char at[12];
+    snprintf(at, sizeof(at), "%lu", (unsigned long)(micros() + us));
+    return at;
+}
+
+TEST(scheduledCommandWaitsForItsTime) {
+    TestStepper stepper;
+    CHECK_EQ(200, control(stepper, "500", microsFromNow(2000)));
+    CHECK(stepper.pending);
+    delayMicroseconds(1999);
+    stepper.easeCommandToSetPoint();
+    CHECK_EQ(0, stepper.setPoint);
+    delayMicroseconds(1);
+    stepper.easeCommandToSetPoint();
+    CHECK_EQ(500, stepper.setPoint);
+    CHECK(!stepper.pending);
+}
+
+TEST(immediateCommandDropsScheduledOne) {
+    TestStepper stepper;
+    control(stepper, "500", microsFromNow(2000));
+    CHECK_EQ(200, control(stepper, "-300"));
+    CHECK(!stepper.pending);
+    delay(10);
+    stepper.easeCommandToSetPoint();
+    CHECK_EQ(-300, stepper.setPoint);
+}
+
+TEST(groupCommandDropsScheduledOne) {
+    TestStepper stepper;
+    control(stepper, "500", microsFromNow(2000));
+    stepper.apply(-300);
+    delay(10);
+    stepper.easeCommandToSetPoint();
+    CHECK_EQ(-300, stepper.setPoint);
+}
+
+TEST(stopDropsScheduledOne) {
+    TestStepper stepper;
+    stepper.apply(400);
+    control(stepper, "500", microsFromNow(2000));
+    stepper.stop();
+    delay(10);
+    stepper.easeCommandToSetPoint();
+    CHECK_EQ(0, stepper.setPoint);
+}
+
+TEST(pastTimeAppliesOnNextStep) {
+    TestStepper stepper;
+    delay(1);
+    char at[12];
+    snprintf(at, sizeof(at), "%lu", micros() - 1);
+    control(stepper, "500", at);
+    stepper.easeCommandToSetPoint();
+    CHECK_EQ(500, stepper.setPoint);
+}
+
+TEST(farFutureIsRefused) {
+    TestStepper stepper;
+    CHECK_EQ(400, control(stepper, "500", microsFromNow(stepper.scheduleMax * 1000 + 1)));
+    CHECK(!stepper.pending);
+}
+
+TEST(slewInterpolatesSetPoint) {
+    TestStepper stepper;
+    control(stepper, "1000", nullptr, "100");
+    delay(25);
+    stepper.easeCommandToSetPoint();
+    CHECK_EQ(250, stepper.setPoint);
+    delay(75);
+    stepper.easeCommandToSetPoint();
+    CHECK_EQ(1000, stepper.setPoint);
+}
+
+TEST(commandRampsByChangeMax) {
+    TestStepper stepper;
+    stepper.apply(250);
+    stepper.easeCommandToSetPoint();
+    CHECK_EQ(100, stepper.command);
+    stepper.easeCommandToSetPoint();
+    stepper.easeCommandToSetPoint();
+    CHECK_EQ(250, stepper.command);
+    stepper.apply(5000);  // clamped to commandMax
+    CHECK_EQ(1024, stepper.setPoint);
+}
+
+TEST(directionChangeWaitsSetupTime) {
+    TestStepper stepper;
+    stepper.directionLevel = HIGH;
+    uint64_t start = hostNanos;
+    stepper.writeDirection(100);  // HIGH to LOW
+    CHECK_EQ(LOW, digitalRead(stepper.pinDirection));
+    CHECK(stepper.directionSetup <= hostNanos - start);
+    start = hostNanos;
+    stepper.writeDirection(200);  // no change, no wait
+    CHECK(hostNanos - start < stepper.directionSetup);
+}
+
+struct Stalled {};
+
+TEST(latePulseGoesOutAtOnce) {
+    TestStepper stepper;
+    stepper.setPoint = stepper.command = 1000;
+    unsigned long pause = stepper.calculatePause();
+    stepper.directionSetup = 2 * pause * 1000;  // a reversal makes the next pulse late
+    int pulses = 0;
+    int level = LOW;
+    uint64_t start = hostNanos;
+    hostYield = [&]() {
+        int pulse = digitalRead(stepper.pinPulse);
+        if (HIGH == pulse && LOW == level && 3 == ++pulses) stepper.setPoint = stepper.command = 0;
+        level = pulse;
+        if (1 == pulses) stepper.setPoint = stepper.command = -1000;
+        if (1000000000ull < hostNanos - start) throw Stalled();
+    };
+    bool stalled = false;
+    try {
+        stepper.loop();
+    } catch (Stalled &) {
+        stalled = true;
+    }
+    hostYield = nullptr;
+    CHECK(!stalled);
+    CHECK_EQ(3, pulses);
+    CHECK(pause <= stepper.takeStall());  // counted as late, not waited for
+}
@@ -0,0 +1,129 @@
+// Deadline tasks and the idle task that sleeps until the earliest one
+#include <hosttest.h>
+
+#include <tickless.h>
+
+// Counts its passes and sleeps [period] ms after each
+class Ticker : public DeadlineTask {
+   public:
+    unsigned long period;
+    int runs = 0;
+
+    Ticker(unsigned long period = 0) : period(period) {}
+
+   protected:
+    void loop() {
+        runs++;
+        if (0 < period) sleep(period);
+    }
+};
+
+TEST(newTaskIsDue) {
+    Ticker task;
+    CHECK(task.due(millis()));
+    SchedulerClass::run(&task);
+    CHECK_EQ(1, task.runs);
+}
+
+TEST(sleepingTaskWaitsForDeadline) {
+    Ticker task(50);
+    SchedulerClass::run(&task);
+    delay(49);
+    SchedulerClass::run(&task);
+    CHECK_EQ(1, task.runs);
+    delay(1);
+    SchedulerClass::run(&task);
+    CHECK_EQ(2, task.runs);
+}
+
+TEST(notifyWakesEarlyOnce) {
+    Ticker task(1000);
+    SchedulerClass::run(&task);
+    task.notify();
+    SchedulerClass::run(&task);
+    CHECK_EQ(2, task.runs);
+    SchedulerClass::run(&task);
+    CHECK_EQ(2, task.runs);  // asleep again for its period
+}
+
+TEST(taskWithoutDeadlineRunsEveryPass) {
+    Ticker task;
+    for (int i = 0; i < 3; i++)
+        SchedulerClass::run(&task);
+    CHECK_EQ(3, task.runs);
+}
+
+TEST(nextWakeupIsEarliestDeadline) {
+    Tickless clock;
+    Ticker slow(100), fast(30);
+    clock.add(&slow);
+    clock.add(&fast);
+    SchedulerClass::run(&slow);
+    SchedulerClass::run(&fast);
+    unsigned long now = millis();
+    CHECK_EQ(30, clock.nextWakeup(now, 1000));
+    CHECK_EQ(20, clock.nextWakeup(now, 20));
+    CHECK_EQ(0, clock.nextWakeup(now + 30, 1000));
+    slow.notify();
+    CHECK_EQ(0, clock.nextWakeup(now, 1000));
+}
+
+TEST(addRefusesBeyondCapacity) {
+    Tickless clock;
+    Ticker task;
+    for (int i = 0; i < TICKLESS_MAX_TASKS; i++)
+        CHECK(clock.add(&task));
+    CHECK(!clock.add(&task));
+}
+
+// The global tickless knows every DeadlineTask made in this file, the
+// finished tests' tasks are gone; start it over with [task] alone
+void only(DeadlineTask *task) {
+    tickless.taskCount = 0;
+    tickless.add(task);
+    tickless.awake = 0;
+}
+
+TEST(idleSleepsUntilNextDeadline) {
+    Ticker task(15);
+    only(&task);
+    SchedulerClass::run(&task);
+    unsigned long start = millis();
+    SchedulerClass::run(&idleTask);
+    CHECK_EQ(15, millis() - start);
+    CHECK(task.due(millis()));
+}
+
+TEST(idleSleepIsBounded) {
+    Ticker task(1000);
+    only(&task);
+    SchedulerClass::run(&task);
+    unsigned long start = millis();
+    SchedulerClass::run(&idleTask);
+    CHECK_EQ(idleTask.maxIdle, millis() - start);
+}
+
+TEST(awakeHolderKeepsIdleFromSleeping) {
+    Ticker task(1000);
+    only(&task);
+    SchedulerClass::run(&task);
+    tickless.awake = 1;
+    unsigned long start = millis();
+    SchedulerClass::run(&idleTask);
+    CHECK_EQ(0, millis() - start);
+    tickless.awake = 0;
+}
+
+TEST(idleShareIsMeasured) {
+    Ticker task(10);
+    only(&task);
+    delay(idleTask.measureInterval);  // start a measurement
+    SchedulerClass::run(&idleTask);
+    for (int i = 0; i < 1000; i++) {
+        SchedulerClass::run(&task);
+        SchedulerClass::run(&idleTask);  // 10 ms
+        delay(10);                       // busy for as long
+    }
+    SchedulerClass::run(&idleTask);
+    CHECK_EQ(50, idleTask.idlePercent);
+}
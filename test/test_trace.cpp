@@ -0,0 +1,182 @@
+// Trace events recorded on the fake clock, exported as Chrome trace JSON and
+// parsed back
+#include <hosttest.h>
+
+#define TRACE_SIZE 16  // wraps within a test
+#include <trace.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Collects the export
+class StringPrint : public Print {
+   public:
+    std::string text;
+
+    using Print::write;
+    size_t write(const uint8_t *buffer, size_t size) override {
+        text.append((const char *)buffer, size);
+        return size;
+    }
+};
+
+// Just enough JSON for the export: objects, arrays, strings without
+// escapes and non-negative integers, false on anything else
+struct Json {
+    std::string string;
+    long number = -1;
+    std::vector<Json> array;
+    std::map<std::string, Json> object;
+
+    const Json &operator[](const char *key) const {
+        static Json none;
+        auto it = object.find(key);
+        return object.end() == it ? none : it->second;
+    }
+};
+
+bool parse(const char *&s, Json &out) {
+    while (isspace(*s)) s++;
+    if ('{' == *s || '[' == *s) {
+        char close = '{' == *s ? '}' : ']';
+        s++;
+        while (isspace(*s)) s++;
+        if (close == *s) return s++;
+        while (true) {
+            Json value;
+            if ('}' == close) {
+                Json key;
+                if (!parse(s, key) || key.string.empty()) return false;
+                while (isspace(*s)) s++;
+                if (':' != *s++ || !parse(s, value)) return false;
+                out.object[key.string] = value;
+            } else {
+                if (!parse(s, value)) return false;
+                out.array.push_back(value);
+            }
+            while (isspace(*s)) s++;
+            if (close == *s) return s++;
+            if (',' != *s++) return false;
+        }
+    }
+    if ('"' == *s) {
+        const char *end = strchr(++s, '"');
+        if (nullptr == end) return false;
+        out.string.assign(s, end);
+        s = end + 1;
+        return true;
+    }
+    if (!isdigit(*s)) return false;
+    out.number = strtol(s, (char **)&s, 10);
+    return true;
+}
+
+// The events of the export, without the track names
+std::vector<Json> exported() {
+    StringPrint out;
+    trace.writeTo(out);
+    Json doc;
+    const char *s = out.text.c_str();
+    if (!parse(s, doc) || "ms" != doc["displayTimeUnit"].string) return {};
+    std::vector<Json> events;
+    for (const Json &e : doc["traceEvents"].array)
+        if ("M" != e["ph"].string) events.push_back(e);
+    return events;
+}
+
+TEST(tracksAreNamed) {
+    StringPrint out;
+    trace.writeTo(out);
+    Json doc;
+    const char *s = out.text.c_str();
+    CHECK(parse(s, doc));
+    const std::vector<Json> &events = doc["traceEvents"].array;
+    CHECK_EQ(TRACE_MAX_TRACKS - 1, events.size());
+    for (int track = 1; track < TRACE_MAX_TRACKS; track++) {
+        const Json &e = events[track - 1];
+        CHECK(e["ph"].string == "M");
+        CHECK_EQ(track, e["tid"].number);
+        CHECK(e["args"]["name"].string == trace.trackNames[track]);
+    }
+}
+
+// Nested scopes on one track: begin and end in order, the time between them
+// is the duration, ts counts from the first event
+TEST(scopesNestWithTheirDurations) {
+    delay(5);
+    {
+        TRACE_SCOPE(TRACE_TRACK_LOOP, "outer");
+        delayMicroseconds(100);
+        {
+            TRACE_SCOPE(TRACE_TRACK_LOOP, "inner");
+            delayMicroseconds(250);
+            TRACE_INSTANT(TRACE_TRACK_LOOP, "mark");
+        }
+        delayMicroseconds(50);
+    }
+    std::vector<Json> events = exported();
+    CHECK_EQ(5, events.size());
+    const char *names[] = {"outer", "inner", "mark", "inner", "outer"};
+    const char *phases[] = {"B", "B", "i", "E", "E"};
+    for (int i = 0; i < 5; i++) {
+        CHECK(events[i]["name"].string == names[i]);
+        CHECK(events[i]["ph"].string == phases[i]);
+        CHECK_EQ(TRACE_TRACK_LOOP, events[i]["tid"].number);
+        CHECK_EQ(1, events[i]["pid"].number);
+    }
+    CHECK(events[2]["s"].string == "t");  // an instant marks its track only
+    CHECK_EQ(0, events[0]["ts"].number);
+    long innerDur = events[3]["ts"].number - events[1]["ts"].number;
+    long outerDur = events[4]["ts"].number - events[0]["ts"].number;
+    CHECK_EQ(250, innerDur);
+    CHECK_EQ(400, outerDur);
+}
+
+TEST(pulsesOnlyWhenAsked) {
+    TRACE_PULSE();
+    trace.pulses = true;
+    for (int i = 0; i < 3; i++) {
+        TRACE_PULSE();
+        delayMicroseconds(500);
+    }
+    trace.pulses = false;
+    TRACE_PULSE();
+    std::vector<Json> events = exported();
+    CHECK_EQ(3, events.size());
+    for (int i = 0; i < 3; i++) {
+        CHECK(events[i]["name"].string == "pulse");
+        CHECK(events[i]["ph"].string == "i");
+        CHECK_EQ(TRACE_TRACK_STEPPER, events[i]["tid"].number);
+        CHECK_EQ(i * 500, events[i]["ts"].number);
+    }
+}
+
+// A full ring exports the latest TRACE_SIZE events, oldest first
+TEST(fullBufferKeepsTheLatest) {
+    static char names[40][8];
+    for (int i = 0; i < 40; i++) {
+        snprintf(names[i], sizeof(names[i]), "e%d", i);
+        TRACE_INSTANT(TRACE_TRACK_HTTP, names[i]);
+        delayMicroseconds(10 + i);
+    }
+    CHECK_EQ(40, trace.total);
+    std::vector<Json> events = exported();
+    CHECK_EQ(TRACE_SIZE, events.size());
+    long last = -1;
+    for (int i = 0; i < TRACE_SIZE; i++) {
+        CHECK(events[i]["name"].string == names[40 - TRACE_SIZE + i]);
+        CHECK(last < events[i]["ts"].number);
+        last = events[i]["ts"].number;
+    }
+    CHECK_EQ(0, events[0]["ts"].number);
+    CHECK_EQ(0, trace.total);  // writeTo() starts a new recording
+    CHECK(trace.recording);
+}
+
+TEST(nothingRecordedWhileExporting) {
+    trace.beginExport();
+    TRACE_INSTANT(TRACE_TRACK_LOOP, "late");
+    trace.endExport();
+    CHECK_EQ(0, exported().size());
+}
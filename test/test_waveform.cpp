@@ -0,0 +1,144 @@
+// Renders I2S step waveforms and decodes the bitstream back into edges
+#include <vector>
+
+#include <hosttest.h>
+
+#include "waveform.h"
+
+struct Pulse {
+    uint32_t start;  // tick of the rising edge
+    uint32_t width;  // ticks
+};
+
+// Bits of [words] in the order they go out, MSB first
+std::vector<bool> bits(const std::vector<uint32_t> &words) {
+    std::vector<bool> out;
+    for (uint32_t word : words)
+        for (int bit = 31; 0 <= bit; bit--)
+            out.push_back(word >> bit & 1);
+    return out;
+}
+
+// Pulses completed within the stream, a pulse still high at the end is left out
+std::vector<Pulse> decode(const std::vector<bool> &stream) {
+    std::vector<Pulse> pulses;
+    bool high = false;
+    uint32_t rise = 0;
+    for (uint32_t tick = 0; tick < stream.size(); tick++) {
+        if (stream[tick] == high) continue;
+        high = stream[tick];
+        if (high)
+            rise = tick;
+        else
+            pulses.push_back({rise, tick - rise});
+    }
+    return pulses;
+}
+
+std::vector<bool> render(StepWaveform &waveform, int words, uint32_t *started = nullptr) {
+    std::vector<uint32_t> buf(words);
+    uint32_t n = waveform.render(buf.data(), words);
+    if (nullptr != started) *started = n;
+    return bits(buf);
+}
+
+TEST(rendersPeriodAndWidth) {
+    StepWaveform waveform;
+    waveform.period = 100;
+    waveform.pulseWidth = 10;
+    waveform.restart();
+    uint32_t started;
+    std::vector<Pulse> pulses = decode(render(waveform, 10, &started));  // 320 ticks
+    CHECK_EQ(4, started);
+    CHECK_EQ(4, pulses.size());
+    for (size_t i = 0; i < pulses.size(); i++) {
+        CHECK_EQ(i * 100, pulses[i].start);
+        CHECK_EQ(10, pulses[i].width);
+    }
+}
+
+TEST(continuesAcrossBuffers) {
+    StepWaveform whole, pieces;
+    whole.period = pieces.period = 77;
+    whole.pulseWidth = pieces.pulseWidth = 5;
+    whole.restart();
+    pieces.restart();
+    std::vector<bool> expected = render(whole, 100);
+    std::vector<bool> stream;
+    int rendered = 0;
+    for (int size = 1; rendered < 100; size = size % 7 + 1) {
+        int n = rendered + size <= 100 ? size : 100 - rendered;
+        std::vector<bool> part = render(pieces, n);
+        stream.insert(stream.end(), part.begin(), part.end());
+        rendered += n;
+    }
+    CHECK(expected == stream);
+    CHECK_EQ(whole.pulses, pieces.pulses);
+}
+
+TEST(widePulsesFillWholeWords) {
+    StepWaveform waveform;
+    waveform.period = 200;
+    waveform.pulseWidth = 70;
+    waveform.restart();
+    std::vector<Pulse> pulses = decode(render(waveform, 22));  // 704 ticks
+    CHECK_EQ(4, pulses.size());
+    for (size_t i = 0; i < pulses.size(); i++) {
+        CHECK_EQ(i * 200, pulses[i].start);
+        CHECK_EQ(70, pulses[i].width);
+    }
+}
+
+TEST(staysLowWhileStopped) {
+    StepWaveform waveform;
+    uint32_t started;
+    std::vector<bool> stream = render(waveform, 8, &started);
+    CHECK_EQ(0, started);
+    for (bool bit : stream)
+        CHECK(!bit);
+    waveform.restart();  // a restart without a period does not pulse
+    CHECK_EQ(0, decode(render(waveform, 8)).size());
+}
+
+TEST(stoppingFinishesThePulse) {
+    StepWaveform waveform;
+    waveform.period = 64;
+    waveform.pulseWidth = 40;
+    waveform.restart();
+    render(waveform, 1);  // 32 ticks into the first pulse
+    waveform.period = 0;
+    std::vector<bool> stream = render(waveform, 4);
+    for (int tick = 0; tick < 8; tick++)
+        CHECK(stream[tick]);
+    for (size_t tick = 8; tick < stream.size(); tick++)
+        CHECK(!stream[tick]);
+}
+
+TEST(newPeriodCountsFromTheLastPulse) {
+    StepWaveform waveform;
+    waveform.period = 160;
+    waveform.pulseWidth = 4;
+    waveform.restart();
+    std::vector<bool> stream = render(waveform, 6);  // 192 ticks, pulses at 0 and 160
+    waveform.period = 64;  // the next pulse is due 64 ticks after the one at 160
+    std::vector<bool> rest = render(waveform, 6);
+    stream.insert(stream.end(), rest.begin(), rest.end());
+    std::vector<Pulse> pulses = decode(stream);
+    CHECK_EQ(5, pulses.size());  // 384 ticks
+    uint32_t expected[] = {0, 160, 224, 288, 352};
+    for (int i = 0; i < 5; i++)
+        CHECK_EQ(expected[i], pulses[i].start);
+}
+
+TEST(shortenedPeriodPulsesAtOnce) {
+    StepWaveform waveform;
+    waveform.period = 160;
+    waveform.pulseWidth = 4;
+    waveform.restart();
+    render(waveform, 3);  // 96 ticks since the pulse at 0
+    waveform.period = 50;  // overdue, the next pulse starts on the next tick
+    std::vector<Pulse> pulses = decode(render(waveform, 4));
+    CHECK(2 <= pulses.size());
+    CHECK_EQ(0, pulses[0].start);
+    CHECK_EQ(50, pulses[1].start);
+}
@@ -0,0 +1,259 @@
+#!/usr/bin/env python3
+"""Load generator for the controller API, run from a PC on the server's network.
+
+Simulates N remotes and M browser sessions against the real endpoints of a
+server, each on its own thread and connection:
+
+  - a remote keeps its connection alive and sends /api/control at a fixed
+    interval, sweeping the command over -command-max..command-max, with a
+    client id of its own ("load01", "load02", ...), like distinct remotes
+  - a browser session polls /api/config over a kept-alive connection and
+    reloads /ui on a new connection each time
+
+Every report interval one JSON line per kind of request is printed, followed
+by the server's own view of the same period from /api/stats?reset=1: step
+jitter, admission counters, the advertised rate and the heap:
+
+  {"load":"control","requests":200,"perSecond":20.0,"mean":9120,"p50":8013,"p90":...}
+  {"load":"host","stats":{"jitter":[...],"admission":{...},"rate":{...},"heap":{...}}}
+
+Latencies are in us. "refused" counts 409 (leased to another remote), 429
+(rate limited) and 503 (shed), "errors" anything else that is not 2xx,
+including connection failures, "skipped" the requests not sent because the
+previous one of the same sender took longer than the interval.
+
+Remotes with their own ids compete for the device's lease, only the holder's
+commands are applied, the others are refused with 409 after running the
+whole request path. --shared-id makes them one controller instead. The
+server rate limits per remote address, to load it beyond that from one PC,
+give the PC several addresses and spread the connections with --bind.
+
+Example, 8 remotes at 5 commands/s each and 2 browsers for a minute:
+
+  tools/loadgen.py 192.168.4.1 --remotes 8 --control-interval 200 --browsers 2 --duration 60
+"""
+
+import argparse
+import http.client
+import json
+import sys
+import threading
+import time
+
+
+class Traffic:
+    """Latencies and outcomes of one kind of request, shared by its senders"""
+
+    REFUSED = (409, 429, 503)
+
+    def __init__(self, name):
+        self.name = name
+        self.lock = threading.Lock()
+        self.reset()
+
+    def reset(self):
+        self.latencies = []
+        self.errors = 0
+        self.refused = 0
+        self.skipped = 0
+
+    def record(self, status, us):
+        with self.lock:
+            self.latencies.append(us)
+            if status in self.REFUSED:
+                self.refused += 1
+            elif status < 200 or 300 <= status:
+                self.errors += 1
+
+    def skip(self, count):
+        with self.lock:
+            self.skipped += count
+
+    def report(self, elapsed):
+        with self.lock:
+            latencies = sorted(self.latencies)
+            line = {
+                "load": self.name,
+                "requests": len(latencies),
+                "perSecond": round(len(latencies) / elapsed, 1) if 0 < elapsed else 0,
+                "mean": int(sum(latencies) / len(latencies)) if latencies else 0,
+                "p50": percentile(latencies, 50),
+                "p90": percentile(latencies, 90),
+                "p99": percentile(latencies, 99),
+                "max": latencies[-1] if latencies else 0,
+                "errors": self.errors,
+                "refused": self.refused,
+                "skipped": self.skipped,
+            }
+            self.reset()
+        print(json.dumps(line), flush=True)
+
+
+def percentile(values, percent):
+    if not values:
+        return 0
+    rank = max(1, -(-len(values) * percent // 100))  # ceil
+    return values[rank - 1]
+
+
+class Sender(threading.Thread):
+    """Sends one kind of request every [interval] s until [stop] is set"""
+
+    def __init__(self, args, traffic, interval, stop, bind):
+        super().__init__(daemon=True)
+        self.args = args
+        self.traffic = traffic
+        self.interval = interval
+        self.stop = stop
+        self.bind = bind
+        self.connection = None
+
+    def connect(self):
+        source = (self.bind, 0) if self.bind else None
+        return http.client.HTTPConnection(self.args.host, self.args.port,
+                                          timeout=self.args.timeout, source_address=source)
+
+    def get(self, path, keep_alive=True):
+        start = time.perf_counter()
+        status = 0
+        try:
+            if not keep_alive or self.connection is None:
+                if self.connection is not None:
+                    self.connection.close()
+                self.connection = self.connect()
+            self.connection.request("GET", path)
+            response = self.connection.getresponse()
+            response.read()
+            status = response.status
+            if not keep_alive or response.will_close:
+                self.connection.close()
+                self.connection = None
+        except (OSError, http.client.HTTPException):
+            if self.connection is not None:
+                self.connection.close()
+            self.connection = None
+        self.traffic.record(status, int((time.perf_counter() - start) * 1e6))
+
+    def run(self):
+        next_time = time.monotonic()
+        while not self.stop.is_set():
+            self.send()
+            next_time += self.interval
+            now = time.monotonic()
+            if next_time <= now:  # behind, don't catch up
+                self.traffic.skip(int((now - next_time) / self.interval) + 1)
+                next_time = now + self.interval
+            self.stop.wait(next_time - now)
+
+    def send(self):
+        raise NotImplementedError
+
+
+class Remote(Sender):
+    def __init__(self, args, traffic, stop, bind, client):
+        super().__init__(args, traffic, args.control_interval / 1000, stop, bind)
+        self.client = client
+        self.command = 0
+
+    def send(self):
+        top = self.args.command_max
+        self.command = -top if top <= self.command else self.command + max(1, top // 8)
+        self.get("/api/control?device=%s&command=%d&client=%s" % (self.args.device, self.command, self.client))
+
+
+class ConfigPoller(Sender):
+    def __init__(self, args, traffic, stop, bind):
+        super().__init__(args, traffic, args.config_interval / 1000, stop, bind)
+
+    def send(self):
+        self.get("/api/config")
+
+
+class PageLoader(Sender):
+    def __init__(self, args, traffic, stop, bind):
+        super().__init__(args, traffic, args.ui_interval / 1000, stop, bind)
+
+    def send(self):
+        self.get("/ui", keep_alive=False)
+
+
+def host_stats(args):
+    """The server's stats since the last call, the jitter restarts with each call"""
+    try:
+        connection = http.client.HTTPConnection(args.host, args.port, timeout=args.timeout)
+        connection.request("GET", "/api/stats?reset=1")
+        response = connection.getresponse()
+        body = response.read()
+        connection.close()
+        if 200 != response.status:
+            return None
+        stats = json.loads(body)
+    except (OSError, http.client.HTTPException, ValueError):
+        return None
+    return {key: stats[key] for key in ("jitter", "admission", "rate", "heap") if key in stats}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Load the controller API with simulated remotes and browsers.")
+    parser.add_argument("host", help="server address")
+    parser.add_argument("--port", type=int, default=50123)
+    parser.add_argument("--device", default="Stepper1", help="device the remotes command")
+    parser.add_argument("--remotes", type=int, default=4)
+    parser.add_argument("--control-interval", type=float, default=200, help="ms between the commands of each remote")
+    parser.add_argument("--command-max", type=int, default=512)
+    parser.add_argument("--shared-id", action="store_true", help="all remotes use one client id")
+    parser.add_argument("--browsers", type=int, default=1)
+    parser.add_argument("--config-interval", type=float, default=1000, help="ms between config polls of each browser, 0: none")
+    parser.add_argument("--ui-interval", type=float, default=5000, help="ms between page loads of each browser, 0: none")
+    parser.add_argument("--bind", default="", help="comma separated local addresses the connections are spread over")
+    parser.add_argument("--duration", type=float, default=60, help="s, 0: until interrupted")
+    parser.add_argument("--report", type=float, default=10, help="s between reports")
+    parser.add_argument("--timeout", type=float, default=5, help="s per request")
+    args = parser.parse_args()
+
+    binds = [b for b in args.bind.split(",") if b] or [""]
+    control = Traffic("control")
+    config = Traffic("config")
+    ui = Traffic("ui")
+    stop = threading.Event()
+    senders = []
+    for i in range(args.remotes):
+        client = "load" if args.shared_id else "load%02d" % (i + 1)
+        senders.append(Remote(args, control, stop, binds[i % len(binds)], client))
+    for i in range(args.browsers):
+        bind = binds[(args.remotes + i) % len(binds)]
+        if 0 < args.config_interval:
+            senders.append(ConfigPoller(args, config, stop, bind))
+        if 0 < args.ui_interval:
+            senders.append(PageLoader(args, ui, stop, bind))
+
+    print("[Load] %d remotes every %g ms, %d browsers on %s:%d" %
+          (args.remotes, args.control_interval, args.browsers, args.host, args.port), file=sys.stderr)
+    host_stats(args)  # starts the server's jitter statistics along with ours
+    started = time.monotonic()
+    for sender in senders:
+        sender.start()
+    try:
+        period_start = started
+        while not stop.is_set():
+            end = period_start + args.report
+            if 0 < args.duration:
+                end = min(end, started + args.duration)
+            time.sleep(max(0, end - time.monotonic()))
+            now = time.monotonic()
+            if 0 < args.duration and started + args.duration <= now:
+                stop.set()
+            for traffic in (control, config, ui):
+                traffic.report(now - period_start)
+            stats = host_stats(args)
+            if stats is not None:
+                print(json.dumps({"load": "host", "stats": stats}), flush=True)
+            period_start = now
+    except KeyboardInterrupt:
+        stop.set()
+    for sender in senders:
+        sender.join(args.timeout)
+
+
+if __name__ == "__main__":
+    main()